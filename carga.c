@@ -0,0 +1,609 @@
+#define _GNU_SOURCE     //IP_PKTINFO / struct in_pktinfo
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <endian.h>
+#include "common.h"
+
+/*
+gerador de carga para o servidor.
+simula milhares de contas usando um endereco de 127.0.0.0/8 para cada uma: cada thread
+tem um unico socket e escolhe o endereco de origem de cada pacote com IP_PKTINFO, e as
+respostas sao associadas a conta pelo endereco de destino (tambem via IP_PKTINFO).
+cada conta tem no maximo uma requisicao em voo (como o cliente), e cada thread mantem
+ate 'pipeline' contas ocupadas ao mesmo tempo. espera um servidor recem iniciado
+(os seqns de cada conta comecam em 1). com -B cada requisicao em voo e um lote
+(TYPE_BATCH_REQ) de 'batch_size' transferencias com seqns consecutivos.
+*/
+
+//constantes globais
+#define ACCOUNT_BASE 0x7f010000u        //127.1.0.0: primeira conta simulada
+#define INVALID_DEST 0x7ffffffeu        //127.255.255.254: nunca registrado
+#define MAX_ACCOUNTS (1u << 22)
+#define REGISTER_TIMEOUT_MS 100
+#define REGISTER_RETRIES 20
+#define PKTINFO_CTRL_LEN CMSG_SPACE(sizeof(struct in_pktinfo))
+
+//parametros (linha de comando)
+static int num_threads = 4;
+static uint32_t num_accounts = 4096;
+static int duration_s = 5;
+static uint32_t pipeline = 32;          //requisicoes em voo por thread
+static int query_pct = 10;              //% de consultas de saldo (valor 0)
+static int invalid_pct = 0;             //% de transferencias para destino inexistente
+static int hot_pct = 0;                 //% de transferencias para as contas quentes
+static uint32_t hot_accounts = 16;
+static uint32_t max_value = 10;
+static long timeout_us = 200000;        //retransmissao de requisicoes sem resposta
+static uint32_t batch_size = 0;         //transferencias por lote (0 = requisicoes simples)
+static struct sockaddr_in server_addr;
+
+static atomic_bool stop_flag = false;
+static pthread_barrier_t start_barrier;
+
+/*
+histograma de latencias log-linear: valores abaixo de 2^HIST_SUB_BITS tem um balde cada;
+acima, cada potencia de 2 e dividida em 2^HIST_SUB_BITS baldes (erro relativo < 1,6%).
+*/
+#define HIST_SUB_BITS 6
+#define HIST_SUB (1u << HIST_SUB_BITS)
+#define HIST_BUCKETS ((40 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} latency_hist;
+
+static size_t hist_index(uint64_t v) {
+    if (v < HIST_SUB) {return (size_t)v;}
+    int msb = 63 - __builtin_clzll(v);
+    size_t idx = (size_t)(msb - HIST_SUB_BITS + 1) * HIST_SUB + (size_t)((v >> (msb - HIST_SUB_BITS)) - HIST_SUB);
+    return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+//maior valor que cai no balde 'idx'
+static uint64_t hist_upper(size_t idx) {
+    if (idx < HIST_SUB) {return idx;}
+    size_t k = idx / HIST_SUB;
+    size_t r = idx % HIST_SUB;
+    return ((uint64_t)(HIST_SUB + r + 1) << (k - 1)) - 1;
+}
+
+static void hist_record(latency_hist *h, uint64_t v) {
+    h->counts[hist_index(v)]++;
+    h->total++;
+    if (v > h->max) {h->max = v;}
+}
+
+static void hist_merge(latency_hist *dst, const latency_hist *src) {
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    if (src->max > dst->max) {dst->max = src->max;}
+}
+
+static uint64_t hist_percentile(const latency_hist *h, double p) {
+    if (h->total == 0) {return 0;}
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)h->total);
+    if (rank >= h->total) {rank = h->total - 1;}
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen > rank) {
+            uint64_t v = hist_upper(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+//estado de uma conta simulada
+typedef struct {
+    uint32_t seqn;              //ultimo seqn enviado
+    bool busy;                  //ha requisicao em voo
+    uint32_t slot;              //posicao em 'inflight' enquanto ocupada
+    uint64_t first_us;          //primeiro envio da requisicao em voo
+    uint64_t last_us;           //ultimo envio (para o timeout)
+    packet pkt;                 //requisicao em voo (modo sem lote)
+} account;
+
+//tamanho no datagrama de um lote de 'batch_size' entradas
+#define BATCH_LEN (offsetof(batch_packet, entries) + batch_size * sizeof(batch_entry))
+
+typedef struct {
+    int id;
+    pthread_t tid;
+    int sockfd;
+    uint32_t first;             //contas [first, first + count) pertencem a esta thread
+    uint32_t count;
+    account *accounts;
+    char *batches;              //modo lote: o lote em voo de cada conta (BATCH_LEN bytes cada)
+    uint32_t *idle;             //contas locais livres
+    uint32_t num_idle;
+    uint32_t *inflight;         //contas locais com requisicao em voo
+    uint32_t num_inflight;
+    uint32_t rng;
+    latency_hist hist;
+    uint64_t completed;
+    uint64_t errors;            //TYPE_ERROR_REQ (destino inexistente)
+    uint64_t retransmits;
+} worker;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+//xorshift32: gerador barato por thread
+static uint32_t next_rand(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static struct in_addr account_addr(uint32_t global_id) {
+    struct in_addr a;
+    a.s_addr = htonl(ACCOUNT_BASE + global_id);
+    return a;
+}
+
+//envia 'pkt' ao servidor com o endereco de origem 'src' (IP_PKTINFO)
+static void send_from(int sockfd, struct in_addr src, const void *pkt, size_t len) {
+    char ctrl[PKTINFO_CTRL_LEN];
+    memset(ctrl, 0, sizeof(ctrl));
+    struct iovec iov = { .iov_base = (void *)pkt, .iov_len = len };
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_name = &server_addr;
+    hdr.msg_namelen = sizeof(server_addr);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = sizeof(ctrl);
+
+    struct cmsghdr *c = CMSG_FIRSTHDR(&hdr);
+    c->cmsg_level = IPPROTO_IP;
+    c->cmsg_type = IP_PKTINFO;
+    c->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+    struct in_pktinfo info;
+    memset(&info, 0, sizeof(info));
+    info.ipi_spec_dst = src;
+    memcpy(CMSG_DATA(c), &info, sizeof(info));
+
+    sendmsg(sockfd, &hdr, 0);
+}
+
+/*
+recebe uma resposta de ate 'cap' bytes sem bloquear. retorna o tamanho, ou 0 se nao
+houver nenhuma. 'dst' recebe o endereco para o qual o servidor respondeu (a conta).
+*/
+static size_t recv_reply(int sockfd, void *buf, size_t cap, struct in_addr *dst) {
+    char ctrl[PKTINFO_CTRL_LEN];
+    struct iovec iov = { .iov_base = buf, .iov_len = cap };
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = sizeof(ctrl);
+
+    ssize_t n = recvmsg(sockfd, &hdr, MSG_DONTWAIT);
+    if (n <= 0) {return 0;}
+
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&hdr); c != NULL; c = CMSG_NXTHDR(&hdr, c)) {
+        if (c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_PKTINFO) {
+            struct in_pktinfo info;
+            memcpy(&info, CMSG_DATA(c), sizeof(info));
+            *dst = info.ipi_addr;
+            return (size_t)n;
+        }
+    }
+    return 0;
+}
+
+//espera ate 'timeout_ms' por dados no socket
+static void wait_readable(int sockfd, int timeout_ms) {
+    struct pollfd pfd = { .fd = sockfd, .events = POLLIN };
+    poll(&pfd, 1, timeout_ms);
+}
+
+/*
+registra as contas da thread (descoberta enviada de cada endereco).
+varias descobertas ficam em voo ao mesmo tempo; as sem resposta sao reenviadas.
+*/
+static int register_accounts(worker *w) {
+    uint8_t *done = calloc(w->count, 1);
+    if (done == NULL) {return -1;}
+    packet disc;
+    memset(&disc, 0, sizeof(disc));
+    disc.type = htons(TYPE_DESCOBERTA);
+
+    uint32_t remaining = w->count;
+    for (int attempt = 0; attempt < REGISTER_RETRIES && remaining > 0; attempt++) {
+        uint32_t sent = 0;
+        for (uint32_t i = 0; i < w->count; i++) {
+            if (done[i]) {continue;}
+            send_from(w->sockfd, account_addr(w->first + i), &disc, sizeof(disc));
+            //lotes pequenos para nao estourar o buffer do socket do servidor
+            if (++sent % 256 == 0) {
+                uint64_t until = now_us() + 2000;
+                while (now_us() < until) {
+                    packet reply;
+                    struct in_addr dst;
+                    if (recv_reply(w->sockfd, &reply, sizeof(reply), &dst) < sizeof(packet)) {wait_readable(w->sockfd, 1); continue;}
+                    uint32_t id = ntohl(dst.s_addr) - ACCOUNT_BASE - w->first;
+                    if (ntohs(reply.type) == TYPE_ACK_DESCOBERTA && id < w->count && !done[id]) {
+                        done[id] = 1;
+                        remaining--;
+                    }
+                }
+            }
+        }
+
+        uint64_t until = now_us() + REGISTER_TIMEOUT_MS * 1000;
+        while (remaining > 0 && now_us() < until) {
+            packet reply;
+            struct in_addr dst;
+            if (recv_reply(w->sockfd, &reply, sizeof(reply), &dst) < sizeof(packet)) {
+                wait_readable(w->sockfd, 1);
+                continue;
+            }
+            uint32_t id = ntohl(dst.s_addr) - ACCOUNT_BASE - w->first;
+            if (ntohs(reply.type) == TYPE_ACK_DESCOBERTA && id < w->count && !done[id]) {
+                done[id] = 1;
+                remaining--;
+            }
+        }
+    }
+    free(done);
+    return remaining == 0 ? 0 : -1;
+}
+
+//escolhe destino e valor de uma nova transferencia conforme o mix configurado
+static void pick_transfer(worker *w, uint32_t global_id, struct in_addr *dest_out, uint32_t *value_out) {
+    uint32_t r = next_rand(&w->rng) % 100;
+    uint32_t value = 0;
+    struct in_addr dest;
+
+    if ((int)r < query_pct) {
+        dest = account_addr(global_id);             //consulta: valor 0
+    }
+    else if ((int)r < query_pct + invalid_pct) {
+        dest.s_addr = htonl(INVALID_DEST);
+        value = 1;
+    }
+    else {
+        uint32_t d;
+        if ((int)(next_rand(&w->rng) % 100) < hot_pct) {
+            d = next_rand(&w->rng) % hot_accounts;
+        }
+        else {
+            d = next_rand(&w->rng) % num_accounts;
+        }
+        dest = account_addr(d);
+        value = 1 + next_rand(&w->rng) % max_value;
+    }
+    *dest_out = dest;
+    *value_out = value;
+}
+
+//monta a proxima requisicao (ou o proximo lote) da conta
+static void fill_request(worker *w, uint32_t local) {
+    account *acc = &w->accounts[local];
+    struct in_addr dest;
+    uint32_t value;
+
+    if (batch_size > 0) {
+        batch_packet *bp = (batch_packet *)(w->batches + (size_t)local * BATCH_LEN);
+        bp->type = htons(TYPE_BATCH_REQ);
+        bp->count = htons((uint16_t)batch_size);
+        for (uint32_t i = 0; i < batch_size; i++) {
+            pick_transfer(w, w->first + local, &dest, &value);
+            bp->entries[i].seqn = htonl(++acc->seqn);
+            bp->entries[i].dest_addr = dest;
+            bp->entries[i].value = htonl(value);
+        }
+        return;
+    }
+
+    pick_transfer(w, w->first + local, &dest, &value);
+    acc->seqn++;
+    memset(&acc->pkt, 0, sizeof(packet));
+    acc->pkt.type = htons(TYPE_REQ);
+    acc->pkt.seqn = htonl(acc->seqn);
+    acc->pkt.dest_addr = dest;
+    acc->pkt.value = htonl(value);
+}
+
+//(re)envia a requisicao ou o lote em voo da conta
+static void send_request(worker *w, uint32_t local) {
+    if (batch_size > 0) {
+        send_from(w->sockfd, account_addr(w->first + local), w->batches + (size_t)local * BATCH_LEN, BATCH_LEN);
+    }
+    else {
+        send_from(w->sockfd, account_addr(w->first + local), &w->accounts[local].pkt, sizeof(packet));
+    }
+}
+
+//tira uma conta livre aleatoria e envia sua proxima requisicao
+static void start_request(worker *w) {
+    uint32_t pos = next_rand(&w->rng) % w->num_idle;
+    uint32_t local = w->idle[pos];
+    w->idle[pos] = w->idle[--w->num_idle];
+
+    account *acc = &w->accounts[local];
+    fill_request(w, local);
+    acc->busy = true;
+    acc->slot = w->num_inflight;
+    w->inflight[w->num_inflight++] = local;
+    acc->first_us = acc->last_us = now_us();
+    send_request(w, local);
+}
+
+//requisicao respondida: registra a latencia e devolve a conta para as livres
+static void finish_request(worker *w, uint32_t local, bool measuring) {
+    account *acc = &w->accounts[local];
+    uint32_t last = w->inflight[--w->num_inflight];
+    w->inflight[acc->slot] = last;
+    w->accounts[last].slot = acc->slot;
+    acc->busy = false;
+    w->idle[w->num_idle++] = local;
+
+    if (measuring) {
+        hist_record(&w->hist, now_us() - acc->first_us);
+        w->completed += batch_size > 0 ? batch_size : 1;
+    }
+}
+
+/*
+confere a resposta 'buf' ('n' bytes) da conta: um ACK (ou erro) do seqn em voo ou, no
+modo lote, um TYPE_ACK_BATCH do lote em voo com todas as entradas processadas.
+re-ACKs de seqns anteriores (duplicatas/fora de ordem) sao ignorados.
+*/
+static bool reply_completes(worker *w, uint32_t local, const char *buf, size_t n) {
+    account *acc = &w->accounts[local];
+    if (!acc->busy) {return false;}
+
+    if (batch_size == 0) {
+        const packet *reply = (const packet *)buf;
+        if (n < sizeof(packet) || ntohl(reply->seqn) != acc->seqn) {return false;}
+        if (ntohs(reply->type) == TYPE_ERROR_REQ) {w->errors++;}
+        else if (ntohs(reply->type) != TYPE_ACK_REQ) {return false;}
+        return true;
+    }
+
+    const batch_ack *ack = (const batch_ack *)buf;
+    if (n < offsetof(batch_ack, results) + batch_size * sizeof(batch_result) ||
+            ntohs(ack->type) != TYPE_ACK_BATCH || ntohs(ack->count) != batch_size ||
+            ntohl(ack->results[batch_size - 1].seqn) != acc->seqn) {
+        return false;
+    }
+    uint64_t errors = 0;
+    for (uint32_t i = 0; i < batch_size; i++) {
+        uint16_t type = ntohs(ack->results[i].type);
+        if (type == 0) {return false;}      //fora de ordem: o lote sera reenviado
+        if (type == TYPE_ERROR_REQ) {errors++;}
+    }
+    w->errors += errors;
+    return true;
+}
+
+static void *worker_thread(void *arg) {
+    worker *w = (worker *)arg;
+
+    if (register_accounts(w) != 0) {
+        fprintf(stderr, "thread %d: falha ao registrar as contas\n", w->id);
+        exit(EXIT_FAILURE);
+    }
+    pthread_barrier_wait(&start_barrier);
+
+    uint64_t last_scan = now_us();
+    while (!atomic_load_explicit(&stop_flag, memory_order_relaxed)) {
+        while (w->num_inflight < pipeline && w->num_idle > 0) {
+            start_request(w);
+        }
+
+        wait_readable(w->sockfd, 1);
+        char reply[sizeof(batch_ack)];
+        struct in_addr dst;
+        size_t n;
+        while ((n = recv_reply(w->sockfd, reply, sizeof(reply), &dst)) > 0) {
+            uint32_t local = ntohl(dst.s_addr) - ACCOUNT_BASE - w->first;
+            if (local < w->count && reply_completes(w, local, reply, n)) {
+                finish_request(w, local, true);
+            }
+        }
+
+        //retransmite o que passou do timeout
+        uint64_t now = now_us();
+        if (now - last_scan >= 1000) {
+            last_scan = now;
+            for (uint32_t i = 0; i < w->num_inflight; i++) {
+                account *acc = &w->accounts[w->inflight[i]];
+                if (now - acc->last_us >= (uint64_t)timeout_us) {
+                    acc->last_us = now;
+                    w->retransmits++;
+                    send_request(w, w->inflight[i]);
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+//pede ao servidor os histogramas de desempenho (TYPE_STATS_REQ) e os imprime
+static void print_server_stats(int sockfd) {
+    static const char *names[STATS_NUM_HISTS] = {
+        "latencia descoberta (ns)", "latencia requisicao (ns)", "latencia lote (ns)",
+        "espera por trava (ns)", "profundidade da fila", "profundidade do log"
+    };
+    packet req;
+    memset(&req, 0, sizeof(req));
+    req.type = htons(TYPE_STATS_REQ);
+    sendto(sockfd, &req, sizeof(req), 0, (const struct sockaddr *)&server_addr, sizeof(server_addr));
+
+    stats_reply reply;
+    uint64_t until = now_us() + 500000;
+    while (now_us() < until) {
+        wait_readable(sockfd, 10);
+        ssize_t n = recv(sockfd, &reply, sizeof(reply), MSG_DONTWAIT);
+        if (n == (ssize_t)sizeof(reply) && ntohs(reply.type) == TYPE_STATS_ACK) {
+            printf("servidor: %u contas, num_transactions %u total_transferred %u total_balance %u\n",
+                   ntohl(reply.num_clients), ntohl(reply.num_transactions),
+                   ntohl(reply.total_transferred), ntohl(reply.total_balance));
+            for (int h = 0; h < STATS_NUM_HISTS && h < ntohs(reply.num_hists); h++) {
+                stats_hist_summary *s = &reply.hists[h];
+                printf("  %-26s n %lu p50 %lu p90 %lu p99 %lu p999 %lu max %lu\n", names[h],
+                       (unsigned long)be64toh(s->count), (unsigned long)be64toh(s->p50),
+                       (unsigned long)be64toh(s->p90), (unsigned long)be64toh(s->p99),
+                       (unsigned long)be64toh(s->p999), (unsigned long)be64toh(s->max));
+            }
+            return;
+        }
+    }
+    printf("servidor: sem resposta ao pedido de estatisticas\n");
+}
+
+static int open_socket(void) {
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {return -1;}
+    int on = 1;
+    int buf = 4 << 20;
+    if (setsockopt(sockfd, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on)) != 0) {
+        close(sockfd);
+        return -1;
+    }
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+    return sockfd;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Use: ./carga <porta> [-s ip_servidor] [-t threads] [-c contas] [-d duracao_s] [-p em_voo_por_thread]\n");
+    fprintf(stderr, "                     [-q %%consultas] [-x %%destino_invalido] [-H %%quente -k contas_quentes] [-v valor_max]\n");
+    fprintf(stderr, "                     [-B transferencias_por_lote]\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *server_ip = "127.0.0.1";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:c:d:p:q:x:H:k:v:B:")) != -1) {
+        switch (opt) {
+            case 's': server_ip = optarg; break;
+            case 't': num_threads = atoi(optarg); break;
+            case 'c': num_accounts = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'd': duration_s = atoi(optarg); break;
+            case 'p': pipeline = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'q': query_pct = atoi(optarg); break;
+            case 'x': invalid_pct = atoi(optarg); break;
+            case 'H': hot_pct = atoi(optarg); break;
+            case 'k': hot_accounts = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'v': max_value = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'B': batch_size = (uint32_t)strtoul(optarg, NULL, 10); break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1 || num_threads < 1 || duration_s < 1 || pipeline < 1 ||
+            num_accounts < (uint32_t)num_threads || num_accounts > MAX_ACCOUNTS ||
+            query_pct < 0 || invalid_pct < 0 || query_pct + invalid_pct > 100 ||
+            hot_pct < 0 || hot_pct > 100 || hot_accounts < 1 || hot_accounts > num_accounts || max_value < 1 ||
+            batch_size > MAX_BATCH_ENTRIES) {
+        usage();
+        return 1;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(atoi(argv[optind]));
+    if (inet_aton(server_ip, &server_addr.sin_addr) == 0) {
+        fprintf(stderr, "Endereco IP invalido\n");
+        return 1;
+    }
+
+    worker *workers = calloc((size_t)num_threads, sizeof(worker));
+    if (workers == NULL) {
+        perror("falha ao alocar threads");
+        return 1;
+    }
+    pthread_barrier_init(&start_barrier, NULL, (unsigned)num_threads + 1);
+
+    for (int t = 0; t < num_threads; t++) {
+        worker *w = &workers[t];
+        w->id = t;
+        w->first = (uint32_t)((uint64_t)num_accounts * (uint64_t)t / (uint64_t)num_threads);
+        w->count = (uint32_t)((uint64_t)num_accounts * (uint64_t)(t + 1) / (uint64_t)num_threads) - w->first;
+        w->accounts = calloc(w->count, sizeof(account));
+        w->batches = batch_size > 0 ? malloc(w->count * BATCH_LEN) : NULL;
+        w->idle = malloc(w->count * sizeof(uint32_t));
+        w->inflight = malloc(w->count * sizeof(uint32_t));
+        w->rng = 0x9e3779b9u ^ (uint32_t)(t + 1) * 2654435761u;
+        w->sockfd = open_socket();
+        if (w->accounts == NULL || (batch_size > 0 && w->batches == NULL) ||
+                w->idle == NULL || w->inflight == NULL || w->sockfd < 0) {
+            perror("falha ao preparar thread");
+            return 1;
+        }
+        for (uint32_t i = 0; i < w->count; i++) {
+            w->idle[i] = i;
+        }
+        w->num_idle = w->count;
+        if (pthread_create(&w->tid, NULL, worker_thread, w) != 0) {
+            perror("falha ao criar thread");
+            return 1;
+        }
+    }
+
+    printf("carga: %d threads, %u contas, %u em voo por thread, %d s, consultas %d%%, invalidas %d%%, quentes %d%% de %u\n",
+           num_threads, num_accounts, pipeline, duration_s, query_pct, invalid_pct, hot_pct, hot_accounts);
+    if (batch_size > 0) {
+        printf("carga: lotes de %u transferencias (requisicoes contam transferencias; latencia por lote)\n", batch_size);
+    }
+    fflush(stdout);
+
+    //espera todas as contas serem registradas e mede so a fase de transferencias
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start = now_us();
+    sleep((unsigned)duration_s);
+    atomic_store(&stop_flag, true);
+    uint64_t elapsed = now_us() - start;
+
+    latency_hist *total = calloc(1, sizeof(latency_hist));
+    uint64_t completed = 0, errors = 0, retransmits = 0;
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(workers[t].tid, NULL);
+        hist_merge(total, &workers[t].hist);
+        completed += workers[t].completed;
+        errors += workers[t].errors;
+        retransmits += workers[t].retransmits;
+    }
+
+    double secs = (double)elapsed / 1e6;
+    printf("requisicoes %lu em %.2f s: %.0f req/s (erros %lu, retransmissoes %lu)\n",
+           (unsigned long)completed, secs, (double)completed / secs,
+           (unsigned long)errors, (unsigned long)retransmits);
+    printf("latencia (us): p50 %lu p99 %lu p999 %lu max %lu\n",
+           (unsigned long)hist_percentile(total, 50.0), (unsigned long)hist_percentile(total, 99.0),
+           (unsigned long)hist_percentile(total, 99.9), (unsigned long)total->max);
+    print_server_stats(workers[0].sockfd);
+    return 0;
+}
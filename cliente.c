@@ -8,47 +8,189 @@
 #include <time.h>
 #include <sys/select.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
 #include "common.h"
 
 //constantes globais
 #define BROADCAST_IP "255.255.255.255"
-#define MAX_RETRIES 3
-#define TIMEOUT_MS 10
+#define MAX_RETRIES 5
+//limites do timeout de retransmissao (RTO) adaptativo, em microssegundos
+#define INITIAL_RTO_US 10000    //antes da primeira medida de RTT
+#define MIN_RTO_US 2000
+#define MAX_RTO_US 1000000
+#define CLOCK_GRANULARITY_US 1000
 #define MSG_BUFFER_SIZE 512
+#define MAX_WINDOW 1024
+#define DUP_ACK_THRESHOLD 3     //ACKs duplicados que disparam retransmissao rapida
+#define REQ_QUEUE_CAP 4096      //requisicoes lidas e ainda nao enviadas (potencia de 2)
+#define OUTPUT_RING_CAP 4096    //mensagens por anel de saida (potencia de 2)
+#define OUTPUT_WRITE_BATCH 64   //mensagens por writev (<= IOV_MAX)
+#define OUTPUT_IDLE_WAIT_MS 50
+#define INPUT_CHUNK 65536       //bytes por leitura no modo arquivo
+
+//requisicao lida da entrada (ja validada)
+typedef struct {
+    char ip[20];
+    struct in_addr dest;
+    uint32_t valor;
+} req_entry;
+
+/*
+indices de um anel SPSC (um produtor, um consumidor) sem travas. cada lado so escreve
+o seu indice, em linhas de cache separadas; o outro lado le com acquire. a capacidade e
+potencia de 2 e os indices crescem sem limite (posicao = indice & (cap - 1)).
+*/
+typedef struct {
+    _Atomic size_t head __attribute__((aligned(CACHE_LINE)));  //proxima posicao a consumir
+    _Atomic size_t tail __attribute__((aligned(CACHE_LINE)));  //proxima posicao a produzir
+    size_t cap;
+} spsc_index;
+
+//posicoes livres (lado produtor)
+static inline size_t spsc_writable(spsc_index* r) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    return r->cap - (tail - atomic_load_explicit(&r->head, memory_order_acquire));
+}
+
+//posicoes prontas (lado consumidor)
+static inline size_t spsc_readable(spsc_index* r) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    return atomic_load_explicit(&r->tail, memory_order_acquire) - head;
+}
+
+//publica 'n' posicoes ja escritas a partir de 'tail'
+static inline void spsc_publish(spsc_index* r, size_t n) {
+    atomic_store_explicit(&r->tail, atomic_load_explicit(&r->tail, memory_order_relaxed) + n, memory_order_release);
+}
+
+//libera 'n' posicoes ja lidas a partir de 'head'
+static inline void spsc_consume(spsc_index* r, size_t n) {
+    atomic_store_explicit(&r->head, atomic_load_explicit(&r->head, memory_order_relaxed) + n, memory_order_release);
+}
+
+//mensagem para a stdout, ja com o '\n' final
+typedef struct {
+    size_t len;
+    char text[MSG_BUFFER_SIZE];
+} out_msg;
+
+typedef struct out_node {
+    out_msg msg;
+    struct out_node* next;
+} out_node;
+
+/*
+anel de mensagens de um produtor (main ou thread de input) para a thread de output.
+com o anel cheio o produtor nao espera: guarda a mensagem em uma lista de transbordo
+propria (so ele mexe nela) e a move para o anel nas proximas chamadas.
+*/
+typedef struct {
+    spsc_index idx;
+    out_msg slots[OUTPUT_RING_CAP];
+    out_node* spill_head;
+    out_node* spill_tail;
+} out_ring;
 
 //globais do cliente
-//requisição
-char req_ip[20];
-uint32_t req_valor;
-bool req_ready = false;
+//requisição: anel SPSC da thread de input para a main
+spsc_index req_idx;     //.cap definido na main (inicializador nao nulo levaria o anel para .data)
+req_entry req_queue[REQ_QUEUE_CAP];
+atomic_bool req_closed = false;         //fim da entrada: nada mais sera enfileirado
+atomic_bool req_space_waiting = false;  //a thread de input espera espaco no anel
 pthread_mutex_t req_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t req_cond = PTHREAD_COND_INITIALIZER;
-//resposta
-char resp_msg[MSG_BUFFER_SIZE];
-bool resp_ready = false;
+pthread_cond_t req_space_cond = PTHREAD_COND_INITIALIZER;
+const char* input_path = NULL;  //modo arquivo (-f): le e analisa a entrada em blocos
+//resposta: um anel por produtor
+out_ring main_out;      //zerados (ficam em .bss); .cap definido na main
+out_ring input_out;
+__thread out_ring* my_out = &main_out;  //anel da thread atual (a de input troca para o seu)
+atomic_bool output_idle = false;        //a thread de output esta dormindo
 pthread_mutex_t resp_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t resp_cond = PTHREAD_COND_INITIALIZER;
 //flags de controle
-bool program_exit = false;
-bool server_found = false;
+atomic_bool program_exit = false;
+atomic_bool output_exit = false;        //a thread de output so sai quando a main terminar de logar
+atomic_bool server_found = false;
+//a thread de input avisa a main por este pipe (a main espera nele ou em select)
+int window_size = 1;
+int batch_size = 1;         //novas requisicoes por datagrama no modo janela (-b; 1 = sem lote)
+int req_pipe[2] = {-1, -1};
+
+//acorda a thread de output se ela estiver dormindo
+void wake_output(bool force) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (force || atomic_load_explicit(&output_idle, memory_order_relaxed)) {
+        pthread_mutex_lock(&resp_mutex);
+        pthread_cond_signal(&resp_cond);
+        pthread_mutex_unlock(&resp_mutex);
+    }
+}
+
+//move o que couber da lista de transbordo para o anel. retorna se a lista esvaziou
+bool flush_output_spill(out_ring* r) {
+    size_t room = r->spill_head ? spsc_writable(&r->idx) : 0;
+    size_t tail = atomic_load_explicit(&r->idx.tail, memory_order_relaxed);
+    size_t n = 0;
+    while (r->spill_head && n < room) {
+        out_node* node = r->spill_head;
+        r->slots[(tail + n) & (OUTPUT_RING_CAP - 1)] = node->msg;
+        r->spill_head = node->next;
+        free(node);
+        n++;
+    }
+    if (!r->spill_head) {r->spill_tail = NULL;}
+    if (n > 0) {spsc_publish(&r->idx, n);}
+    return r->spill_head == NULL;
+}
 
 /*
 função produtora para a thread de output
-ela adquire o mutex de resposta, quando livre copia a mensagem para o buffer global
-e sinaliza para a thread de output que tem dados prontos
+copia a mensagem para o anel da thread atual (ou para o transbordo, se estiver cheio)
+e acorda a thread de output se ela estiver dormindo. nunca bloqueia.
 */
 void send_to_output(const char* msg) {
-    pthread_mutex_lock(&resp_mutex);
-    while (resp_ready) {
-        pthread_cond_wait(&resp_cond, &resp_mutex);
+    out_ring* r = my_out;
+    size_t len = strnlen(msg, MSG_BUFFER_SIZE - 1);
+    out_msg* dst;
+    out_node* node = NULL;
+
+    if (flush_output_spill(r) && spsc_writable(&r->idx) > 0) {
+        dst = &r->slots[atomic_load_explicit(&r->idx.tail, memory_order_relaxed) & (OUTPUT_RING_CAP - 1)];
     }
+    else {
+        node = malloc(sizeof(out_node));
+        if (!node) {return;}    //sem memoria: a mensagem e perdida, o envio continua
+        node->next = NULL;
+        dst = &node->msg;
+    }
+
     //produz mensagem
-    strncpy(resp_msg, msg, MSG_BUFFER_SIZE - 1);
-    resp_msg[MSG_BUFFER_SIZE - 1] = '\0';
-    resp_ready = true;
-    pthread_cond_signal(&resp_cond);
-    pthread_mutex_unlock(&resp_mutex);
+    memcpy(dst->text, msg, len);
+    dst->text[len] = '\n';
+    dst->len = len + 1;
+
+    if (node) {
+        if (r->spill_tail) {r->spill_tail->next = node;}
+        else {r->spill_head = node;}
+        r->spill_tail = node;
+    }
+    else {
+        spsc_publish(&r->idx, 1);
+    }
+    wake_output(false);
+}
+
+//espera o transbordo da thread atual chegar ao anel (antes de a thread terminar)
+void drain_output_spill(void) {
+    while (!flush_output_spill(my_out)) {
+        wake_output(true);
+        usleep(1000);
+    }
 }
 
 /*
@@ -60,94 +202,678 @@ void get_current_time_str(char* buffer, size_t buffer_size) {
     strftime(buffer, buffer_size, "%Y-%m-%d %H:%M:%S", t);
 }
 
+/*
+encerra a thread de output depois que ela imprimir tudo o que a main produziu.
+o fim da entrada (program_exit) nao basta: no modo janela ainda chegam ACKs a logar.
+*/
+void stop_output(void) {
+    drain_output_spill();
+    atomic_store(&program_exit, true);
+    atomic_store(&output_exit, true);
+    wake_output(true);
+}
+
+//acorda a main quando chegam requisicoes (pipe nao bloqueante; se estiver cheio ela ja vai acordar)
+void notify_main(void) {
+    if (req_pipe[1] >= 0) {
+        char b = 1;
+        if (write(req_pipe[1], &b, 1) < 0) {}
+    }
+}
+
+//escreve as mensagens prontas de um anel com um unico writev. retorna quantas escreveu
+size_t drain_output_ring(out_ring* r) {
+    struct iovec iov[OUTPUT_WRITE_BATCH];
+    size_t n = spsc_readable(&r->idx);
+    if (n == 0) {return 0;}
+    if (n > OUTPUT_WRITE_BATCH) {n = OUTPUT_WRITE_BATCH;}
+
+    size_t head = atomic_load_explicit(&r->idx.head, memory_order_relaxed);
+    for (size_t i = 0; i < n; i++) {
+        out_msg* m = &r->slots[(head + i) & (OUTPUT_RING_CAP - 1)];
+        iov[i].iov_base = m->text;
+        iov[i].iov_len = m->len;
+    }
+
+    //trata escritas parciais
+    struct iovec* cur = iov;
+    int cnt = (int)n;
+    while (cnt > 0) {
+        ssize_t w = writev(STDOUT_FILENO, cur, cnt);
+        if (w < 0) {break;}
+        while (cnt > 0 && (size_t)w >= cur->iov_len) {
+            w -= (ssize_t)cur->iov_len;
+            cur++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            cur->iov_base = (char*)cur->iov_base + w;
+            cur->iov_len -= (size_t)w;
+        }
+    }
+    spsc_consume(&r->idx, n);
+    return n;
+}
+
 /*
 thread consumidora para a stdout
-fica bloqueada aguardando resp_cond
-quuando true, imprime a mensagem global 'resp_msg' e sinalize que buffer esta livre
+esvazia os aneis da main e da thread de input em lotes (um writev por lote).
+sem mensagens, dorme em resp_cond ate um produtor acorda-la (ou um timeout curto).
 */
 void* output_thread_func(void* arg) {
-    pthread_mutex_lock(&resp_mutex);
+    (void)arg;
     while (true) {
-        //espera resposta ou fim do programa
-        while (!resp_ready && !program_exit) {
-            pthread_cond_wait(&resp_cond, &resp_mutex);
-        }
-        
-        if (program_exit && !resp_ready) {
+        if (drain_output_ring(&main_out) + drain_output_ring(&input_out) > 0) {continue;}
+
+        if (atomic_load(&output_exit)) {
+            //os produtores ja publicaram tudo: esvazia o que restou e sai
+            while (drain_output_ring(&main_out) + drain_output_ring(&input_out) > 0) {}
             break;
         }
 
-        printf("%s\n", resp_msg);
-        resp_ready = false;
-        pthread_cond_signal(&resp_cond); 
+        pthread_mutex_lock(&resp_mutex);
+        atomic_store(&output_idle, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (spsc_readable(&main_out.idx) == 0 && spsc_readable(&input_out.idx) == 0 &&
+                !atomic_load(&output_exit)) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += OUTPUT_IDLE_WAIT_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000) {ts.tv_sec++; ts.tv_nsec -= 1000000000;}
+            pthread_cond_timedwait(&resp_cond, &resp_mutex, &ts);
+        }
+        atomic_store(&output_idle, false);
+        pthread_mutex_unlock(&resp_mutex);
     }
-    pthread_mutex_unlock(&resp_mutex);
     return NULL;
 }
 
+/*
+enfileira 'n' requisicoes para a main, esperando quando o anel estiver cheio
+(a leitura da entrada pode esperar; o envio nao). acorda a main pelo pipe.
+*/
+void push_requests(const req_entry* reqs, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        size_t room = spsc_writable(&req_idx);
+        if (room == 0) {
+            notify_main();
+            pthread_mutex_lock(&req_mutex);
+            atomic_store(&req_space_waiting, true);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (spsc_writable(&req_idx) == 0) {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_nsec += 1000000;
+                if (ts.tv_nsec >= 1000000000) {ts.tv_sec++; ts.tv_nsec -= 1000000000;}
+                pthread_cond_timedwait(&req_space_cond, &req_mutex, &ts);
+            }
+            atomic_store(&req_space_waiting, false);
+            pthread_mutex_unlock(&req_mutex);
+            continue;
+        }
+
+        size_t tail = atomic_load_explicit(&req_idx.tail, memory_order_relaxed);
+        size_t k = 0;
+        while (k < room && done < n) {
+            req_queue[(tail + k) & (REQ_QUEUE_CAP - 1)] = reqs[done++];
+            k++;
+        }
+        spsc_publish(&req_idx, k);
+    }
+    notify_main();
+}
+
+//marca o fim da entrada; a main ainda consome o que ja esta no anel
+void close_requests(void) {
+    atomic_store_explicit(&req_closed, true, memory_order_release);
+    notify_main();
+}
+
+/*
+retira a proxima requisicao do anel. com 'wait' espera (no pipe) ate haver uma.
+retorna 1 se pegou uma requisicao, 0 se nao ha nenhuma pronta e -1 no fim da entrada.
+*/
+int pop_request(req_entry* out, bool wait) {
+    while (true) {
+        bool closed = atomic_load_explicit(&req_closed, memory_order_acquire);
+        if (spsc_readable(&req_idx) > 0) {
+            *out = req_queue[atomic_load_explicit(&req_idx.head, memory_order_relaxed) & (REQ_QUEUE_CAP - 1)];
+            spsc_consume(&req_idx, 1);
+
+            //libera a thread de input se ela esperava espaco
+            atomic_thread_fence(memory_order_seq_cst);
+            if (atomic_load_explicit(&req_space_waiting, memory_order_relaxed)) {
+                pthread_mutex_lock(&req_mutex);
+                pthread_cond_signal(&req_space_cond);
+                pthread_mutex_unlock(&req_mutex);
+            }
+            return 1;
+        }
+        if (closed) {return -1;}    //fechado antes de olhar o anel: nada mais vai chegar
+        if (!wait) {return 0;}
+
+        struct pollfd pfd = { .fd = req_pipe[0], .events = POLLIN };
+        poll(&pfd, 1, -1);
+        char drain[64];
+        if (read(req_pipe[0], drain, sizeof(drain)) < 0) {}
+    }
+}
+
+/*
+analisa uma linha "ip valor" da entrada. retorna false se a linha for invalida.
+linhas vazias sao tratadas pelo chamador.
+*/
+bool parse_request_line(char* line, req_entry* out) {
+    char* save = NULL;
+    char* ip = strtok_r(line, " \t\r", &save);
+    char* val = strtok_r(NULL, " \t\r", &save);
+    if (!ip || !val || strtok_r(NULL, " \t\r", &save) != NULL || strlen(ip) >= sizeof(out->ip)) {
+        return false;
+    }
+    char* end;
+    unsigned long v = strtoul(val, &end, 10);
+    if (*end != '\0' || v > UINT32_MAX || inet_aton(ip, &out->dest) == 0) {
+        return false;
+    }
+    strcpy(out->ip, ip);
+    out->valor = (uint32_t)v;
+    return true;
+}
+
+/*
+modo arquivo: le a entrada em blocos grandes, separa as linhas e enfileira as
+requisicoes em lotes, sem o vai e vem de uma requisicao por vez.
+retorna o numero de requisicoes lidas.
+*/
+unsigned long read_request_file(int fd) {
+    char* buf = malloc(INPUT_CHUNK + 1);
+    req_entry* batch = malloc(REQ_QUEUE_CAP / 4 * sizeof(req_entry));
+    if (!buf || !batch) {
+        perror("falha ao alocar buffer de entrada");
+        free(buf);
+        free(batch);
+        return 0;
+    }
+
+    unsigned long total = 0, line_no = 0;
+    size_t used = 0;            //bytes de uma linha incompleta no inicio de 'buf'
+    size_t nbatch = 0;
+    char temp_msg[MSG_BUFFER_SIZE];
+
+    while (1) {
+        ssize_t n = read(fd, buf + used, INPUT_CHUNK - used);
+        if (n < 0) {
+            perror("falha ao ler a entrada");
+            break;
+        }
+        size_t len = used + (size_t)n;
+        bool eof = (n == 0);
+        if (eof && len < INPUT_CHUNK) {buf[len++] = '\n';}     //ultima linha sem '\n'
+
+        size_t start = 0;
+        for (size_t i = 0; i < len; i++) {
+            if (buf[i] != '\n') {continue;}
+            buf[i] = '\0';
+            line_no++;
+            char* line = buf + start;
+            start = i + 1;
+            if (strspn(line, " \t\r") == strlen(line)) {continue;}     //linha vazia
+
+            if (!parse_request_line(line, &batch[nbatch])) {
+                snprintf(temp_msg, sizeof(temp_msg), "Erro: linha %lu inválida, ignorada.", line_no);
+                send_to_output(temp_msg);
+                continue;
+            }
+            total++;
+            if (++nbatch == REQ_QUEUE_CAP / 4) {
+                push_requests(batch, nbatch);
+                nbatch = 0;
+            }
+        }
+
+        //guarda a linha incompleta para o proximo bloco
+        used = len - start;
+        if (used == INPUT_CHUNK) {
+            snprintf(temp_msg, sizeof(temp_msg), "Erro: linha %lu longa demais, ignorada.", line_no + 1);
+            send_to_output(temp_msg);
+            used = 0;
+        }
+        memmove(buf, buf + start, used);
+        if (eof) {break;}
+    }
+
+    if (nbatch > 0) {push_requests(batch, nbatch);}
+    free(buf);
+    free(batch);
+    return total;
+}
+
 /*
 thread "produtora" para stdin
 espera até que o servidor seja descoberto e então entra em um loop lendo IP e valor
-quando a entrada é válida, trava req_mutex, espera se o bufferd e requisição não estiver livre
-depois preenche 'req_ip' e 'req_valor' e e sinaliza 'req_cond' para acordar a thread principal
-em caso de EOF é definido 'program_exit'
+cada entrada válida vai para a fila de requisições, que acorda a thread principal
+no modo arquivo (-f) a entrada é lida em blocos e enfileirada em lotes
+no fim da entrada a fila é fechada (a main processa o que restou e encerra)
 */
 void* input_thread_func(void* arg) {
+    (void)arg;
     char ip_str[20];
     uint32_t valor;
+    my_out = &input_out;    //mensagens desta thread vao pelo seu proprio anel
     
-    bool exit_flag = false;
     //espera ate a thread main encontrar o servidor
-    while (!server_found) {
-        pthread_mutex_lock(&resp_mutex);
-        exit_flag = program_exit;
-        pthread_mutex_unlock(&resp_mutex);
-        if (exit_flag) return NULL;
+    while (!atomic_load(&server_found)) {
+        if (atomic_load(&program_exit)) return NULL;
         
         usleep(100000); //pausa para não sobrecarregar
     }
 
-    if(program_exit) return NULL;
+    if(atomic_load(&program_exit)) return NULL;
+
+    if (input_path != NULL) {
+        int fd = strcmp(input_path, "-") == 0 ? STDIN_FILENO : open(input_path, O_RDONLY);
+        if (fd < 0) {
+            perror("falha ao abrir arquivo de entrada");
+        }
+        else {
+            unsigned long total = read_request_file(fd);
+            if (fd != STDIN_FILENO) {close(fd);}
+            char temp_msg[MSG_BUFFER_SIZE];
+            snprintf(temp_msg, sizeof(temp_msg), "Fim do arquivo: %lu requisições lidas. Encerrando...", total);
+            send_to_output(temp_msg);
+        }
+        close_requests();
+        drain_output_spill();
+        return NULL;
+    }
 
     //loop de leitura da entrada
-    while (scanf("%s %u", ip_str, &valor) == 2) {
-        struct in_addr temp_addr;
-        if (inet_aton(ip_str, &temp_addr) == 0) {
+    while (scanf("%19s %u", ip_str, &valor) == 2) {
+        req_entry entry;
+        if (inet_aton(ip_str, &entry.dest) == 0) {
             send_to_output("Erro: IP inválido. Tente novamente.");
             continue;
         }
-        pthread_mutex_lock(&req_mutex);
-        //espera main processar a req anterior
-        while (req_ready) {
-            pthread_cond_wait(&req_cond, &req_mutex);
-        }
-        
-        strcpy(req_ip, ip_str);
-        req_valor = valor;
-        req_ready = true;
-        pthread_cond_signal(&req_cond);
-        pthread_mutex_unlock(&req_mutex);
+        strcpy(entry.ip, ip_str);
+        entry.valor = valor;
+        push_requests(&entry, 1);
     }
     
     send_to_output("Fim de entrada (Ctrl+D) detectado. Encerrando...");
-    pthread_mutex_lock(&resp_mutex);
-    program_exit = true;
-    pthread_mutex_unlock(&resp_mutex);
-    
-    pthread_cond_signal(&req_cond);
-    pthread_cond_signal(&resp_cond);
+    close_requests();
+    drain_output_spill();
     
     return NULL;
 }
 
+//tempo monotonico em microssegundos
+uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/*
+estimador de RTT no estilo Jacobson/Karn (RFC 6298): media suavizada (srtt) e variacao
+(rttvar) do tempo de resposta do servidor, usadas para o timeout de retransmissao.
+so e alimentado por requisicoes respondidas sem retransmissao (regra de Karn), pois
+nao se sabe a qual envio o ACK de uma retransmitida corresponde. usado so pela main.
+*/
+typedef struct {
+    bool has_sample;
+    uint64_t srtt_us;
+    uint64_t rttvar_us;
+    uint64_t rto_us;
+} rtt_estimator;
+
+rtt_estimator rtt = {false, 0, 0, INITIAL_RTO_US};
+
+void rtt_sample(uint64_t sample_us) {
+    if (!rtt.has_sample) {
+        rtt.srtt_us = sample_us;
+        rtt.rttvar_us = sample_us / 2;
+        rtt.has_sample = true;
+    }
+    else {
+        uint64_t err = rtt.srtt_us > sample_us ? rtt.srtt_us - sample_us : sample_us - rtt.srtt_us;
+        rtt.rttvar_us = (3 * rtt.rttvar_us + err) / 4;
+        rtt.srtt_us = (7 * rtt.srtt_us + sample_us) / 8;
+    }
+    uint64_t var = 4 * rtt.rttvar_us;
+    rtt.rto_us = rtt.srtt_us + (var > CLOCK_GRANULARITY_US ? var : CLOCK_GRANULARITY_US);
+    if (rtt.rto_us < MIN_RTO_US) {rtt.rto_us = MIN_RTO_US;}
+    if (rtt.rto_us > MAX_RTO_US) {rtt.rto_us = MAX_RTO_US;}
+}
+
+//timeout expirou: dobra o RTO, que so volta a cair com uma nova medida
+void rtt_backoff(void) {
+    rtt.rto_us *= 2;
+    if (rtt.rto_us > MAX_RTO_US) {rtt.rto_us = MAX_RTO_US;}
+}
+
+//timeout para o proximo envio: RTO mais ate 25% de atraso aleatorio, para que
+//clientes que perderam pacotes juntos nao retransmitam todos ao mesmo tempo
+uint64_t rtt_timeout(void) {
+    return rtt.rto_us + (uint64_t)rand() % (rtt.rto_us / 4 + 1);
+}
+
+//requisicao enviada e ainda nao confirmada (modo janela)
+typedef struct {
+    bool active;
+    uint32_t seqn;
+    char ip[20];
+    uint32_t valor;
+    packet pkt;
+    uint64_t sent_us;           //instante do primeiro envio (para medir o RTT)
+    uint64_t deadline_us;       //instante da proxima retransmissao
+    int retries;
+    bool resent;                //ja retransmitida: o ACK nao serve como medida de RTT
+} inflight_req;
+
+/*
+modo janela: ate 'window' requisicoes em voo ao mesmo tempo, cada uma com seu temporizador.
+o servidor processa em ordem, entao um ACK de seqn 'a' confirma todas as requisicoes <= a
+(ACK cumulativo); a requisicao exata do ACK e logada com o novo saldo. ACKs repetidos
+do seqn anterior a base indicam que a base se perdeu e disparam retransmissao rapida.
+depois de reenviar a base, um ACK que avanca mas nao cobre tudo que estava em voo (ACK
+parcial) indica a proxima lacuna, que e reenviada na hora sem esperar o temporizador.
+com -b as novas requisicoes saem em lotes (TYPE_BATCH_REQ) e cada resultado do ACK de
+lote e tratado como um ACK simples; retransmissoes vao sempre como requisicoes simples.
+*/
+static void send_batch(int sockfd, struct sockaddr_in* server_addr, batch_packet* batch, uint16_t count) {
+    batch->type = htons(TYPE_BATCH_REQ);
+    batch->count = htons(count);
+    sendto(sockfd, batch, offsetof(batch_packet, entries) + count * sizeof(batch_entry), 0,
+           (const struct sockaddr *)server_addr, sizeof(*server_addr));
+}
+
+void run_windowed(int sockfd, struct sockaddr_in* server_addr, int window) {
+    inflight_req* win = calloc((size_t)window, sizeof(inflight_req));
+    if (!win) {
+        perror("falha ao alocar janela");
+        return;
+    }
+
+    char temp_msg[MSG_BUFFER_SIZE];
+    char time_buffer[100];
+    uint32_t base = 1;          //menor seqn ainda nao confirmado
+    uint32_t next_seqn = 1;     //proximo seqn a atribuir
+    int dup_acks = 0;
+    uint32_t recover = 1;       //next_seqn quando a base foi reenviada (fim da recuperacao)
+    bool input_done = false;
+
+    while (true) {
+        //1. preenche a janela com novas requisicoes da entrada
+        batch_packet batch;
+        uint16_t batched = 0;
+        while (!input_done && next_seqn - base < (uint32_t)window) {
+            req_entry entry;
+            int r = pop_request(&entry, false);
+            if (r < 0) {input_done = true;}
+            if (r <= 0) {break;}
+
+            inflight_req* req = &win[next_seqn % (uint32_t)window];
+            req->active = true;
+            req->seqn = next_seqn;
+            strcpy(req->ip, entry.ip);
+            req->valor = entry.valor;
+            req->retries = 0;
+            req->resent = false;
+            memset(&req->pkt, 0, sizeof(packet));
+            req->pkt.type = htons(TYPE_REQ);
+            req->pkt.seqn = htonl(next_seqn);
+            req->pkt.value = htonl(entry.valor);
+            req->pkt.dest_addr = entry.dest;    //ip destino
+
+            snprintf(temp_msg, sizeof(temp_msg), "Enviando req #%u para %s (valor: %u)...", next_seqn, entry.ip, entry.valor);
+            send_to_output(temp_msg);
+            if (batch_size > 1) {
+                batch.entries[batched].seqn = req->pkt.seqn;
+                batch.entries[batched].dest_addr = req->pkt.dest_addr;
+                batch.entries[batched].value = req->pkt.value;
+                if (++batched == batch_size) {
+                    send_batch(sockfd, server_addr, &batch, batched);
+                    batched = 0;
+                }
+            }
+            else {
+                sendto(sockfd, &req->pkt, sizeof(packet), 0, (const struct sockaddr *)server_addr, sizeof(*server_addr));
+            }
+            req->sent_us = now_us();
+            req->deadline_us = req->sent_us + rtt_timeout();
+            next_seqn++;
+        }
+        if (batched > 0) {send_batch(sockfd, server_addr, &batch, batched);}     //lote incompleto
+
+        //avanca a base sobre as requisicoes ja concluidas (confirmadas ou abandonadas)
+        while (base < next_seqn && !win[base % (uint32_t)window].active) {
+            base++;
+        }
+        if (input_done && base == next_seqn) {break;}
+
+        //2. espera ACK, nova entrada ou o proximo timeout
+        uint64_t now = now_us();
+        uint64_t earliest = UINT64_MAX;    //cada requisicao em voo tem o seu temporizador
+        for (uint32_t s = base; s < next_seqn; s++) {
+            inflight_req* req = &win[s % (uint32_t)window];
+            if (req->active && req->deadline_us < earliest) {earliest = req->deadline_us;}
+        }
+
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(sockfd, &readfds);
+        int maxfd = sockfd;
+        if (!input_done && next_seqn - base < (uint32_t)window) {
+            FD_SET(req_pipe[0], &readfds);
+            if (req_pipe[0] > maxfd) {maxfd = req_pipe[0];}
+        }
+
+        struct timeval timeout;
+        struct timeval* tv = NULL;      //nada em voo: espera so pela entrada
+        if (earliest != UINT64_MAX) {
+            uint64_t wait = earliest > now ? earliest - now : 0;
+            timeout.tv_sec = (time_t)(wait / 1000000u);
+            timeout.tv_usec = (suseconds_t)(wait % 1000000u);
+            tv = &timeout;
+        }
+
+        int ready = select(maxfd + 1, &readfds, NULL, NULL, tv);
+        if (ready < 0) {
+            perror("select");
+            break;
+        }
+
+        if (ready > 0 && FD_ISSET(req_pipe[0], &readfds)) {
+            char drain[64];
+            if (read(req_pipe[0], drain, sizeof(drain)) < 0) {}
+        }
+
+        if (ready > 0 && FD_ISSET(sockfd, &readfds)) {
+            union {
+                packet pkt;
+                batch_ack batch;
+            } reply;
+            struct sockaddr_in sender_addr;
+            socklen_t sender_len = sizeof(sender_addr);
+            int n = recvfrom(sockfd, &reply, sizeof(reply), 0, (struct sockaddr *)&sender_addr, &sender_len);
+
+            //ACKs do datagrama: um simples ou os resultados de um ACK de lote, tratados um a um
+            uint32_t ack_seqns[MAX_BATCH_ENTRIES];
+            uint16_t ack_types[MAX_BATCH_ENTRIES];
+            uint32_t ack_balances[MAX_BATCH_ENTRIES];
+            int num_acks = 0;
+
+            //valida se o pacote veio do servidor esperado
+            if (n > 0 && (sender_addr.sin_addr.s_addr != server_addr->sin_addr.s_addr ||
+                          sender_addr.sin_port != server_addr->sin_port)) {
+                snprintf(temp_msg, sizeof(temp_msg), "Pacote ignorado de %s:%d.",
+                         inet_ntoa(sender_addr.sin_addr), ntohs(sender_addr.sin_port));
+                send_to_output(temp_msg);
+            }
+            else if (n > 0 && (ntohs(reply.pkt.type) == TYPE_ACK_REQ || ntohs(reply.pkt.type) == TYPE_ERROR_REQ)) {
+                ack_seqns[0] = ntohl(reply.pkt.seqn);
+                ack_types[0] = ntohs(reply.pkt.type);
+                ack_balances[0] = ntohl(reply.pkt.balance);
+                num_acks = 1;
+            }
+            else if (n >= (int)offsetof(batch_ack, results) && ntohs(reply.batch.type) == TYPE_ACK_BATCH) {
+                uint16_t count = ntohs(reply.batch.count);
+                for (uint16_t i = 0; i < count && i < MAX_BATCH_ENTRIES &&
+                                     offsetof(batch_ack, results) + (i + 1u) * sizeof(batch_result) <= (size_t)n; i++) {
+                    batch_result* r = &reply.batch.results[i];
+                    if (r->type == 0) {continue;}   //fora de ordem: o temporizador a reenvia
+                    ack_seqns[num_acks] = ntohl(r->seqn);
+                    ack_types[num_acks] = ntohs(r->type);
+                    ack_balances[num_acks] = ntohl(r->balance);
+                    num_acks++;
+                }
+            }
+            else if (n > 0) {
+                snprintf(temp_msg, sizeof(temp_msg), "Erro: pacote inválido (type: %d, seqn: %u).",
+                         ntohs(reply.pkt.type), ntohl(reply.pkt.seqn));
+                send_to_output(temp_msg);
+            }
+
+            for (int k = 0; k < num_acks; k++) {
+                uint32_t acked = ack_seqns[k];
+
+                if (acked >= base && acked < next_seqn) {
+                    //confirma cumulativamente tudo ate 'acked'
+                    inflight_req* exact = &win[acked % (uint32_t)window];
+                    if (exact->active && !exact->resent) {rtt_sample(now_us() - exact->sent_us);}
+                    get_current_time_str(time_buffer, sizeof(time_buffer));
+                    for (uint32_t s = base; s <= acked; s++) {
+                        inflight_req* req = &win[s % (uint32_t)window];
+                        if (!req->active) {continue;}
+                        if (s == acked && ack_types[k] == TYPE_ERROR_REQ) {
+                            snprintf(temp_msg, sizeof(temp_msg), "Erro no servidor: Requisição #%u falhou (ex.: cliente destino não encontrado).", s);
+                        }
+                        else if (s == acked) {
+                            snprintf(temp_msg, sizeof(temp_msg), "%s server %s id req %u dest %s value %u new_balance %u",
+                                     time_buffer, inet_ntoa(server_addr->sin_addr), s, req->ip, req->valor, ack_balances[k]);
+                        }
+                        else {
+                            snprintf(temp_msg, sizeof(temp_msg), "%s server %s id req %u dest %s value %u (confirmada por ACK cumulativo)",
+                                     time_buffer, inet_ntoa(server_addr->sin_addr), s, req->ip, req->valor);
+                        }
+                        send_to_output(temp_msg);
+                        req->active = false;
+                    }
+                    dup_acks = 0;
+                    //houve progresso: as que continuam em voo esperavam atras da base, entao
+                    //os seus temporizadores recomecam a contar agora (como o RTO unico do TCP)
+                    uint64_t rearm = now_us() + rtt.rto_us;
+                    for (uint32_t s = acked + 1; s < next_seqn; s++) {
+                        inflight_req* req = &win[s % (uint32_t)window];
+                        if (req->active && req->deadline_us < rearm) {req->deadline_us = rearm;}
+                    }
+                    //ACK parcial: a proxima requisicao tambem nao chegou (ou o servidor, sem
+                    //espaco para guarda-la, a descartou). num ACK de lote, so apos o ultimo resultado
+                    inflight_req* hole = &win[(acked + 1) % (uint32_t)window];
+                    if (k + 1 == num_acks && acked + 1 < recover && hole->active) {
+                        snprintf(temp_msg, sizeof(temp_msg), "Retransmissão da req #%u (ACK parcial).", acked + 1);
+                        send_to_output(temp_msg);
+                        sendto(sockfd, &hole->pkt, sizeof(packet), 0, (const struct sockaddr *)server_addr, sizeof(*server_addr));
+                        hole->deadline_us = now_us() + rtt_timeout();
+                        hole->resent = true;
+                    }
+                }
+                else if (acked == base - 1 && base < next_seqn) {
+                    //ACK repetido da ultima requisicao processada: a base provavelmente se perdeu
+                    if (++dup_acks == DUP_ACK_THRESHOLD && base >= recover) {
+                        inflight_req* req = &win[base % (uint32_t)window];
+                        snprintf(temp_msg, sizeof(temp_msg), "Retransmissão rápida da req #%u.", base);
+                        send_to_output(temp_msg);
+                        sendto(sockfd, &req->pkt, sizeof(packet), 0, (const struct sockaddr *)server_addr, sizeof(*server_addr));
+                        req->deadline_us = now_us() + rtt_timeout();
+                        req->resent = true;
+                        recover = next_seqn;
+                        dup_acks = 0;
+                    }
+                }
+            }
+        }
+
+        //3. temporizadores: o servidor guarda as requisicoes que chegam adiantadas (ate
+        //REORDER_WINDOW alem da esperada) e as processa quando a lacuna e preenchida, entao
+        //so a base e as requisicoes com o proprio prazo vencido sao reenviadas. apenas a
+        //base gasta tentativas; as demais esperam o ACK cumulativo que a base destrava
+        now = now_us();
+        while (base < next_seqn) {
+            inflight_req* head = &win[base % (uint32_t)window];
+            if (!head->active) {base++; continue;}
+            if (head->deadline_us > now) {break;}
+
+            head->retries++;
+            if (head->retries >= MAX_RETRIES) {
+                rtt_backoff();
+                snprintf(temp_msg, sizeof(temp_msg), "Falha ao enviar requisição #%u após %d tentativas. Desistindo.", base, MAX_RETRIES);
+                send_to_output(temp_msg);
+                head->active = false;
+                continue;
+            }
+
+            snprintf(temp_msg, sizeof(temp_msg), "Reenviando req #%u (tentativa %d/%d)...", base, head->retries + 1, MAX_RETRIES);
+            send_to_output(temp_msg);
+            rtt_backoff();
+            sendto(sockfd, &head->pkt, sizeof(packet), 0, (const struct sockaddr *)server_addr, sizeof(*server_addr));
+            head->deadline_us = now + rtt_timeout();
+            head->resent = true;
+            recover = next_seqn;
+            break;
+        }
+        for (uint32_t s = base + 1; s < next_seqn; s++) {
+            inflight_req* req = &win[s % (uint32_t)window];
+            if (!req->active || req->deadline_us > now) {continue;}
+            //fora da janela de reordenacao do servidor ou perdida
+            snprintf(temp_msg, sizeof(temp_msg), "Reenviando req #%u...", s);
+            send_to_output(temp_msg);
+            sendto(sockfd, &req->pkt, sizeof(packet), 0, (const struct sockaddr *)server_addr, sizeof(*server_addr));
+            req->deadline_us = now + rtt_timeout();
+            req->resent = true;
+        }
+    }
+
+    free(win);
+}
+
 int main(int argc, char *argv[]) {
     
-    if (argc != 2) {
-        fprintf(stderr, "Use: ./cliente <porta>\n");
+    //opcoes: -w <janela> (requisicoes em voo simultaneamente; 1 = pare-e-espere)
+    //        -f <arquivo> (modo nao interativo: le as requisicoes do arquivo, "-" = stdin)
+    //        -b <lote> (modo janela: novas requisicoes enviadas em lotes de ate 'lote')
+    int opt;
+    while ((opt = getopt(argc, argv, "w:f:b:")) != -1) {
+        switch (opt) {
+            case 'w': window_size = atoi(optarg); break;
+            case 'b': batch_size = atoi(optarg); break;
+            case 'f': input_path = optarg; break;
+            default:
+                fprintf(stderr, "Use: ./cliente <porta> [-w janela] [-b lote] [-f arquivo]\n");
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1 || window_size < 1 || window_size > MAX_WINDOW ||
+            batch_size < 1 || batch_size > MAX_BATCH_ENTRIES) {
+        fprintf(stderr, "Use: ./cliente <porta> [-w janela] [-b lote] [-f arquivo]\n");
         return 1;
     }
 
-    int port = atoi(argv[1]);
+    int port = atoi(argv[optind]);
+    srand((unsigned)time(NULL) ^ (unsigned)getpid());   //jitter dos timeouts
+
+    //capacidade dos aneis, antes de qualquer thread ou mensagem
+    req_idx.cap = REQ_QUEUE_CAP;
+    main_out.idx.cap = OUTPUT_RING_CAP;
+    input_out.idx.cap = OUTPUT_RING_CAP;
+
+    //a thread de input acorda a main por um pipe (a main espera nele ou no select do modo janela)
+    if (pipe(req_pipe) != 0 || fcntl(req_pipe[1], F_SETFL, O_NONBLOCK) != 0) {
+        perror("falha ao criar pipe de requisicoes");
+        exit(EXIT_FAILURE);
+    }
     int sockfd;
     struct sockaddr_in server_addr, broadcast_addr;
     packet discovery_pkt, response_pkt;
@@ -162,10 +888,7 @@ int main(int argc, char *argv[]) {
     //criando socket UDP
     if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
         perror("falha na criação do socket.");
-        pthread_mutex_lock(&resp_mutex);
-        program_exit = true; 
-        pthread_mutex_unlock(&resp_mutex);
-        pthread_cond_signal(&resp_cond);
+        stop_output();
         exit(EXIT_FAILURE);
     }
 
@@ -174,8 +897,7 @@ int main(int argc, char *argv[]) {
     if (setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST, &broadcast_enable, sizeof(broadcast_enable)) < 0) {
         perror("falha ao habilitar broadcast");
         close(sockfd);
-        program_exit = true;
-        pthread_cond_signal(&resp_cond);
+        stop_output();
         exit(EXIT_FAILURE);
     }
 
@@ -186,8 +908,7 @@ int main(int argc, char *argv[]) {
 
     if (inet_aton(BROADCAST_IP, &broadcast_addr.sin_addr) == 0) {
         fprintf(stderr, "Endereco IP invalido\n");
-        program_exit = true;
-        pthread_cond_signal(&resp_cond);
+        stop_output();
         exit(EXIT_FAILURE);
     }
 
@@ -213,61 +934,34 @@ int main(int argc, char *argv[]) {
         snprintf(msg_buffer, sizeof(msg_buffer), "%s server_addr %s", time_buffer, inet_ntoa(server_addr.sin_addr));
         send_to_output(msg_buffer);
         
-        server_found = true;
+        atomic_store(&server_found, true);
 
         // inicializa a thread de input
         pthread_t input_tid;
         if (pthread_create(&input_tid, NULL, input_thread_func, NULL) != 0) {
             perror("falha ao criar thread de input");
-            pthread_mutex_lock(&resp_mutex);
-            program_exit = true;
-            pthread_mutex_unlock(&resp_mutex);
-            pthread_cond_signal(&resp_cond);
+            stop_output();
             close(sockfd);
             exit(EXIT_FAILURE);
         }
 
+        if (window_size > 1) {
+            run_windowed(sockfd, &server_addr, window_size);
+            goto main_loop_exit;
+        }
+
         uint32_t seqn_local = 0; //contador de seq local
         //loop de requisição
         while (true) {
-            char local_ip[20];
-            uint32_t local_valor;
-            uint32_t local_seqn;
-            bool exit_flag = false;
-
-            //espera por uma requisição da thread de input
-            pthread_mutex_lock(&req_mutex);
-            while (!req_ready) {
-                pthread_mutex_lock(&resp_mutex);
-                exit_flag = program_exit;
-                pthread_mutex_unlock(&resp_mutex);
-                if (exit_flag) {
-                    pthread_mutex_unlock(&req_mutex);
-                    goto main_loop_exit; //sai dos loops
-                }
-                //espera pelo sinal da thread de input
-                pthread_cond_wait(&req_cond, &req_mutex);
-            }
-
-            // checa novamente após acordar
-            pthread_mutex_lock(&resp_mutex);
-            exit_flag = program_exit;
-            pthread_mutex_unlock(&resp_mutex);
-            if (exit_flag) {
-                pthread_mutex_unlock(&req_mutex);
+            //espera por uma requisição da thread de input (ate a fila fechar e esvaziar)
+            req_entry entry;
+            if (pop_request(&entry, true) < 0) {
                 break; // sai do loop principal
             }
-
-            // consome os dados da requisição
-            strcpy(local_ip, req_ip);
-            local_valor = req_valor;
+            char* local_ip = entry.ip;
+            uint32_t local_valor = entry.valor;
             seqn_local++;
-            local_seqn = seqn_local;
-            req_ready = false;
-            
-            // acorda a thread de input para que ela possa ler o próximo comando
-            pthread_cond_signal(&req_cond); 
-            pthread_mutex_unlock(&req_mutex);
+            uint32_t local_seqn = seqn_local;
 
             // processa a requisição
             packet req_pkt;
@@ -275,10 +969,11 @@ int main(int argc, char *argv[]) {
             req_pkt.type = htons(TYPE_REQ);
             req_pkt.seqn = htonl(local_seqn);
             req_pkt.value = htonl(local_valor);
-            inet_aton(local_ip, &req_pkt.dest_addr);  //ip destino
+            req_pkt.dest_addr = entry.dest;  //ip destino
 
             char temp_msg[MSG_BUFFER_SIZE];
             bool ack_received = false;
+            uint64_t sent_us = 0;
 
             for (int retries = 0; retries < MAX_RETRIES; retries++) {
                 //log de envio/retransmissão
@@ -290,12 +985,14 @@ int main(int argc, char *argv[]) {
                 send_to_output(temp_msg);
                 //envia pacote para o servidor
                 sendto(sockfd, &req_pkt, sizeof(packet), 0, (const struct sockaddr *)&server_addr, sizeof(server_addr));
+                if (retries == 0) {sent_us = now_us();}
 
-                // lógica de timeout
+                // lógica de timeout (RTO adaptativo)
                 packet ack_pkt;
+                uint64_t wait_us = rtt_timeout();
                 struct timeval timeout;
-                timeout.tv_sec = 0;
-                timeout.tv_usec = TIMEOUT_MS * 1000; //converte ms para microssegundos
+                timeout.tv_sec = (time_t)(wait_us / 1000000u);
+                timeout.tv_usec = (suseconds_t)(wait_us % 1000000u);
                 fd_set readfds;
                 FD_ZERO(&readfds);
                 FD_SET(sockfd, &readfds);
@@ -320,6 +1017,7 @@ int main(int argc, char *argv[]) {
 
                     //ack correto recebido
                     if (n > 0 && ntohs(ack_pkt.type) == TYPE_ACK_REQ && ntohl(ack_pkt.seqn) == local_seqn) {
+                        if (retries == 0) {rtt_sample(now_us() - sent_us);}    //regra de Karn
                         get_current_time_str(time_buffer, sizeof(time_buffer));
                         // log de ACK formatado
                         snprintf(temp_msg, sizeof(temp_msg), "%s server %s id req %u dest %s value %u new_balance %u", 
@@ -345,6 +1043,7 @@ int main(int argc, char *argv[]) {
                 } else if (ready == 0) {
                     snprintf(temp_msg, sizeof(temp_msg), "Timeout na recepção de ACK (tentativa %d/%d).", retries + 1, MAX_RETRIES);
                     send_to_output(temp_msg);
+                    rtt_backoff();
                 } else {
                     perror("select");
                     break;
@@ -362,16 +1061,13 @@ int main(int argc, char *argv[]) {
 
         // espera as threads terminarem
         pthread_join(input_tid, NULL);
+        stop_output();
         pthread_join(output_tid, NULL);
 
     } else {
         //falha na descoberta
         send_to_output("Nenhuma resposta do servidor recebida. Encerrando.");
-        pthread_mutex_lock(&resp_mutex);
-        program_exit = true; // sinaliza para output thread sair
-        pthread_mutex_unlock(&resp_mutex);
-        
-        pthread_cond_signal(&resp_cond);
+        stop_output(); // sinaliza para output thread sair
         pthread_join(output_tid, NULL); // espera a output thread
     }
     
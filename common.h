@@ -10,9 +10,27 @@
 #define TYPE_REQ 3
 #define TYPE_ACK_REQ 4
 #define TYPE_ERROR_REQ 5 
+#define TYPE_BATCH_REQ 6        // varias transferencias em um datagrama
+#define TYPE_ACK_BATCH 7        // resultado de cada entrada de um TYPE_BATCH_REQ
+
+#define TYPE_STATS_REQ 8        // pede as estatisticas de desempenho do servidor
+#define TYPE_STATS_ACK 9        // resposta: stats_reply
+
+#define MAX_BATCH_ENTRIES 64
+
+// histogramas do servidor enviados em stats_reply (indices de 'hists')
+#define STATS_HIST_LAT_DISCOVERY 0  // recepcao -> resposta de descobertas, em ns
+#define STATS_HIST_LAT_REQ 1        // recepcao -> resposta de requisicoes, em ns
+#define STATS_HIST_LAT_BATCH 2      // recepcao -> resposta de lotes, em ns
+#define STATS_HIST_LOCK_WAIT 3      // espera por client_lock, em ns
+#define STATS_HIST_QUEUE_DEPTH 4    // requisicoes na fila quando um worker retira um lote
+#define STATS_HIST_LOG_DEPTH 5      // registros no anel de log a cada escrita da interface
+#define STATS_NUM_HISTS 6
 
 #define SALDO_INICIAL 100
 
+#define CACHE_LINE 64           // tamanho da linha de cache (x86-64)
+
 
 typedef struct {
     uint16_t type;          // tipo de pacote
@@ -22,12 +40,70 @@ typedef struct {
     uint32_t balance;     // para ACKs, novo saldo      
 } packet;
 
+// entrada de um lote: os mesmos campos de uma requisicao simples
+typedef struct {
+    uint32_t seqn;
+    struct in_addr dest_addr;
+    uint32_t value;
+} batch_entry;
+
+// lote de transferencias da mesma origem, aplicadas em ordem de seqn.
+// no datagrama vao apenas as 'count' primeiras entradas
+typedef struct {
+    uint16_t type;          // TYPE_BATCH_REQ
+    uint16_t count;
+    batch_entry entries[MAX_BATCH_ENTRIES];
+} batch_packet;
+
+// resultado de uma entrada: TYPE_ACK_REQ (processada, com o saldo apos ela),
+// TYPE_ERROR_REQ (destino desconhecido) ou 0 (fora de ordem, deve ser reenviada)
+typedef struct {
+    uint32_t seqn;
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t balance;
+} batch_result;
+
+typedef struct {
+    uint16_t type;          // TYPE_ACK_BATCH
+    uint16_t count;
+    batch_result results[MAX_BATCH_ENTRIES];
+} batch_ack;
+
+// resumo de um histograma (campos em ordem de rede, htobe64)
+typedef struct {
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} stats_hist_summary;
+
+typedef struct {
+    uint16_t type;          // TYPE_STATS_ACK
+    uint16_t num_hists;     // STATS_NUM_HISTS
+    uint32_t num_clients;
+    uint32_t num_transactions;
+    uint32_t total_transferred;
+    uint32_t total_balance;
+    stats_hist_summary hists[STATS_NUM_HISTS];
+} stats_reply;
+
+struct reorder_buffer;      // definido no servidor
+
+/*
+estado quente de uma conta: tudo o que uma transferencia le ou escreve, incluindo a trava,
+em uma unica linha de cache (64 bytes com o pthread_mutex_t de 40 bytes da glibc x86-64).
+o alinhamento impede que contas vizinhas do vetor dividam uma linha (falso compartilhamento);
+campos frios, como o ip, ficam em um vetor separado no servidor.
+*/
 typedef struct {
-    struct in_addr client_ip;   //endereço ip do cliente
-    uint32_t last_req;          // id da ultima requisicao
-    int32_t balance;
+    _Atomic uint64_t state;     // id da ultima requisicao << 32 | saldo
+    _Atomic uint64_t last_ack;  // ultima resposta, no mesmo formato de 'state' (lido sem trava)
+    struct reorder_buffer *pending; // requisicoes futuras a espera da lacuna (alocado sob demanda)
     pthread_mutex_t client_lock;
-} client_data;
+} __attribute__((aligned(CACHE_LINE))) client_data;
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include "common.h"
+
+/*
+benchmark do layout das contas do servidor.
+varias threads fazem transferencias concorrentes (trava das duas contas em ordem de indice,
+avanco do seqn e debito com um CAS, credito e publicacao do ultimo ACK, como no servidor)
+sobre dois layouts do mesmo vetor de contas:
+  - compacto: o client_data antigo, com ip, last_lsn e a trava lado a lado no vetor
+    (80 bytes por conta, contas vizinhas dividem linhas de cache);
+  - alinhado: o client_data atual, uma linha de cache por conta, campos frios a parte.
+no modo padrao cada thread usa apenas as suas proprias contas, vizinhas das contas de
+outras threads: nao ha compartilhamento real, so falso. com -c as transferencias sao
+entre pares aleatorios de todas as contas.
+*/
+
+//layout antigo de uma conta (antes da separacao quente/frio)
+typedef struct {
+    struct in_addr client_ip;
+    _Atomic uint64_t state;
+    _Atomic uint64_t last_ack;
+    uint64_t last_lsn;
+    struct reorder_buffer *pending;
+    pthread_mutex_t client_lock;
+} packed_account;
+
+//posicao dos campos de uma conta dentro de um vetor, para os dois layouts
+typedef struct {
+    const char *name;
+    char *base;
+    size_t stride;
+    size_t off_state, off_ack, off_lock;
+} layout;
+
+#define LAYOUT(type, arr, label) { label, (char *)(arr), sizeof(type), offsetof(type, state), \
+                                   offsetof(type, last_ack), offsetof(type, client_lock) }
+
+//parametros (linha de comando)
+static int num_threads = 4;
+static int duration_ms = 2000;
+static uint32_t accounts_per_thread = 2;
+static uint32_t shared_accounts = 0;    //0 = contas privadas por thread
+
+static atomic_bool stop_flag = false;
+static pthread_barrier_t start_barrier;
+
+typedef struct {
+    const layout *l;
+    int index;
+    uint64_t transfers;
+} worker_args;
+
+#define FIELD(l, idx, off, type) ((type *)((l)->base + (size_t)(idx) * (l)->stride + (off)))
+
+static void transfer(const layout *l, uint32_t from, uint32_t to, int32_t value) {
+    uint32_t first = from < to ? from : to;
+    uint32_t second = from < to ? to : from;
+
+    pthread_mutex_lock(FIELD(l, first, l->off_lock, pthread_mutex_t));
+    pthread_mutex_lock(FIELD(l, second, l->off_lock, pthread_mutex_t));
+
+    //seqn << 32 | saldo, como no servidor
+    _Atomic uint64_t *from_state = FIELD(l, from, l->off_state, _Atomic uint64_t);
+    uint64_t cur = atomic_load_explicit(from_state, memory_order_acquire);
+    uint64_t next;
+    uint32_t debit;
+    do {
+        debit = (int32_t)(uint32_t)cur >= value ? (uint32_t)value : 0;
+        next = cur + (1ull << 32) - debit;
+    } while (!atomic_compare_exchange_weak_explicit(from_state, &cur, next,
+                                                    memory_order_acq_rel, memory_order_acquire));
+    if (debit > 0) {
+        atomic_fetch_add_explicit(FIELD(l, to, l->off_state, _Atomic uint64_t), debit,
+                                  memory_order_acq_rel);
+    }
+    atomic_store_explicit(FIELD(l, from, l->off_ack, _Atomic uint64_t), next, memory_order_release);
+
+    pthread_mutex_unlock(FIELD(l, second, l->off_lock, pthread_mutex_t));
+    pthread_mutex_unlock(FIELD(l, first, l->off_lock, pthread_mutex_t));
+}
+
+static void *worker(void *arg) {
+    worker_args *w = arg;
+    uint64_t rng = 0x9e3779b97f4a7c15ull * (uint64_t)(w->index + 1);
+    uint64_t n = 0;
+
+    pthread_barrier_wait(&start_barrier);
+    while (!atomic_load_explicit(&stop_flag, memory_order_relaxed)) {
+        for (int i = 0; i < 256; i++) {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            uint32_t from, to;
+            if (shared_accounts) {
+                from = (uint32_t)(rng % shared_accounts);
+                to = (uint32_t)((rng >> 32) % shared_accounts);
+                if (to == from) {to = (to + 1) % shared_accounts;}
+            }
+            else {
+                //contas da thread: intercaladas com as das outras (i, i + T, i + 2T, ...)
+                uint32_t a = (uint32_t)(rng % accounts_per_thread);
+                uint32_t b = (a + 1 + (uint32_t)((rng >> 32) % (accounts_per_thread - 1))) % accounts_per_thread;
+                from = a * (uint32_t)num_threads + (uint32_t)w->index;
+                to = b * (uint32_t)num_threads + (uint32_t)w->index;
+            }
+            transfer(w->l, from, to, (int32_t)(rng >> 60));
+        }
+        n += 256;
+    }
+    w->transfers = n;
+    return NULL;
+}
+
+static void init_accounts(const layout *l, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        pthread_mutex_init(FIELD(l, i, l->off_lock, pthread_mutex_t), NULL);
+        atomic_init(FIELD(l, i, l->off_state, _Atomic uint64_t), (uint32_t)SALDO_INICIAL);
+        atomic_init(FIELD(l, i, l->off_ack, _Atomic uint64_t), (uint32_t)SALDO_INICIAL);
+    }
+}
+
+//roda as threads sobre um layout e retorna transferencias por segundo
+static double run_layout(const layout *l, uint32_t n) {
+    init_accounts(l, n);
+
+    pthread_t *tids = calloc((size_t)num_threads, sizeof(pthread_t));
+    worker_args *args = calloc((size_t)num_threads, sizeof(worker_args));
+    if (!tids || !args) {
+        perror("falha ao alocar threads");
+        exit(EXIT_FAILURE);
+    }
+
+    atomic_store(&stop_flag, false);
+    pthread_barrier_init(&start_barrier, NULL, (unsigned)num_threads + 1);
+    for (int i = 0; i < num_threads; i++) {
+        args[i].l = l;
+        args[i].index = i;
+        if (pthread_create(&tids[i], NULL, worker, &args[i]) != 0) {
+            perror("falha ao criar thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct timespec t0, t1;
+    pthread_barrier_wait(&start_barrier);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    usleep((useconds_t)duration_ms * 1000);
+    atomic_store(&stop_flag, true);
+
+    uint64_t total = 0;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(tids[i], NULL);
+        total += args[i].transfers;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_barrier_destroy(&start_barrier);
+
+    //a soma dos saldos tem que se manter
+    int64_t sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        sum += (int32_t)(uint32_t)atomic_load(FIELD(l, i, l->off_state, _Atomic uint64_t));
+        pthread_mutex_destroy(FIELD(l, i, l->off_lock, pthread_mutex_t));
+    }
+    if (sum != (int64_t)n * SALDO_INICIAL) {
+        fprintf(stderr, "%s: saldo total inconsistente (%lld)\n", l->name, (long long)sum);
+        exit(EXIT_FAILURE);
+    }
+
+    free(tids);
+    free(args);
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    return (double)total / secs;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Uso: ./layout [-t threads] [-d duracao_ms] [-a contas_por_thread] [-c contas_compartilhadas]\n");
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:d:a:c:")) != -1) {
+        switch (opt) {
+            case 't': num_threads = atoi(optarg); break;
+            case 'd': duration_ms = atoi(optarg); break;
+            case 'a': accounts_per_thread = (uint32_t)atol(optarg); break;
+            case 'c': shared_accounts = (uint32_t)atol(optarg); break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (optind != argc || num_threads <= 0 || duration_ms <= 0 || accounts_per_thread < 2 ||
+            shared_accounts == 1) {
+        usage();
+        return 1;
+    }
+
+    uint32_t n = shared_accounts ? shared_accounts : accounts_per_thread * (uint32_t)num_threads;
+    packed_account *packed = calloc(n, sizeof(packed_account));
+    client_data *aligned = aligned_alloc(CACHE_LINE, n * sizeof(client_data));
+    if (!packed || !aligned) {
+        perror("falha ao alocar contas");
+        return 1;
+    }
+    memset(aligned, 0, n * sizeof(client_data));
+
+    layout layouts[2] = {
+        LAYOUT(packed_account, packed, "compacto"),
+        LAYOUT(client_data, aligned, "alinhado"),
+    };
+
+    printf("%d threads, %u contas (%s), %d ms por layout\n", num_threads, n,
+           shared_accounts ? "compartilhadas" : "privadas por thread", duration_ms);
+    double rate[2];
+    for (int i = 0; i < 2; i++) {
+        rate[i] = run_layout(&layouts[i], n);
+        printf("%-9s %3zu bytes/conta  %12.0f transf/s\n", layouts[i].name, layouts[i].stride, rate[i]);
+    }
+    printf("alinhado/compacto: %.2fx\n", rate[1] / rate[0]);
+
+    free(packed);
+    free(aligned);
+    return 0;
+}
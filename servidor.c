@@ -1,3 +1,4 @@
+#define _GNU_SOURCE     //recvmmsg/sendmmsg
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,547 +9,3336 @@
 #include <time.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <endian.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <linux/io_uring.h>
 #include "common.h"
 
 //constantes globais
 #define BUFFER_SIZE 1024
-#define MAX_CLIENTS 100
 #define INITIAL_BALANCE 100
 #define LOG_MSG_LEN 256
+#define DEFAULT_WORKERS 4
+#define DEFAULT_QUEUE_CAP 1024
+#define MAX_IO_BATCH 64         //maximo de datagramas por recvmmsg/sendmmsg
+#define REORDER_WINDOW 32       //seqns futuros guardados por conta a espera da lacuna
 
 void get_current_time(char* buffer, size_t buffer_size);
 
+/*
+tabela de clientes segmentada: um diretorio fixo de ponteiros para blocos de
+CLIENT_CHUNK_SIZE contas. os blocos sao alocados sob demanda e nunca movidos,
+entao o endereco de cada client_data (e do seu client_lock) e estavel.
+os campos frios de cada conta ficam em blocos paralelos ('client_cold_table'), fora
+das linhas de cache disputadas pelas transferencias.
+*/
+#define CLIENT_CHUNK_BITS 12
+#define CLIENT_CHUNK_SIZE (1 << CLIENT_CHUNK_BITS)
+#define MAX_CLIENT_CHUNKS 4096                  //ate 16M contas
+
+struct credit_stripe;
+
+//campos raramente acessados de uma conta (o ip so e lido em snapshots)
+typedef struct {
+    struct in_addr client_ip;   //endereço ip do cliente
+    uint64_t last_lsn;          //LSN do ultimo registro do journal que alterou a conta
+    _Atomic(struct credit_stripe *) credits;   //creditos diferidos (contas quentes, modo -D)
+    _Atomic uint32_t credit_heat;               //leituras restantes com creditos diferidos
+    _Atomic bool credits_dirty;                 //ha delta nos contadores a incorporar
+} client_cold;
+
 //globais do servidor
-client_data client_table[MAX_CLIENTS];
+static client_data *client_table[MAX_CLIENT_CHUNKS];
+static client_cold *client_cold_table[MAX_CLIENT_CHUNKS];
 int num_clients = 0;
-uint32_t num_transactions = 0;
-uint32_t total_transferred = 0;
-uint32_t total_balance = 0;
 
-pthread_mutex_t client_table_mutex; //mutex para adicoes e buscas na tabela
-pthread_mutex_t stats_mutex;        //mutex para acessar estatisticas globais
+pthread_mutex_t client_table_mutex; //serializa registros (unico escritor do indice de clientes)
+
+/*
+estatisticas globais divididas em shards, um por thread, cada um em sua propria linha
+de cache. cada thread so incrementa o seu shard; leituras somam todos os shards em uso.
+total_balance so muda no registro de clientes, entao fica em um contador unico.
+*/
+#define STATS_SHARDS 64
+#define STATS_SNAPSHOT_TRIES 4
+
+typedef struct {
+    _Atomic uint32_t num_transactions;
+    _Atomic uint32_t total_transferred;
+} __attribute__((aligned(CACHE_LINE))) stats_shard;
+
+//copia consistente das estatisticas para logs
+typedef struct {
+    uint32_t num_transactions;
+    uint32_t total_transferred;
+    uint32_t total_balance;
+} stats_snapshot;
+
+static stats_shard stats_shards[STATS_SHARDS];
+static _Atomic uint32_t stats_shards_used = 0;
+static _Atomic uint32_t total_balance = 0;
+static __thread stats_shard *my_stats_shard = NULL;
+
+//retorna a conta de indice 'idx' (deve ser < num_clients)
+static inline client_data *client_at(int idx) {
+    return &client_table[idx >> CLIENT_CHUNK_BITS][idx & (CLIENT_CHUNK_SIZE - 1)];
+}
+
+//campos frios da conta de indice 'idx'
+static inline client_cold *client_cold_at(int idx) {
+    return &client_cold_table[idx >> CLIENT_CHUNK_BITS][idx & (CLIENT_CHUNK_SIZE - 1)];
+}
+
+/*
+last_req e saldo de uma conta ficam em uma unica palavra atomica ('state', seqn << 32 |
+saldo), para que consultas de saldo avancem o seqn e leiam o saldo sem trava nenhuma.
+transferencias continuam sob as travas das duas contas, mas o avanco do seqn da origem e
+o debito sao um unico CAS, entao uma consulta concorrente nunca ve um sem o outro.
+creditos somam direto na metade baixa (o saldo nunca e negativo nem passa de 2^31).
+*/
+static inline uint32_t state_seqn(uint64_t state) {return (uint32_t)(state >> 32);}
+static inline int32_t state_balance(uint64_t state) {return (int32_t)(uint32_t)state;}
+static inline uint64_t make_state(uint32_t seqn, int32_t balance) {
+    return ((uint64_t)seqn << 32) | (uint32_t)balance;
+}
+
+static inline uint64_t account_state(client_data *client) {
+    return atomic_load_explicit(&client->state, memory_order_acquire);
+}
+
+/*
+avanca o seqn da conta para 'seqn' se ele for o esperado (last_req + 1), debitando 'value'
+se houver saldo. em '*moved' (se nao NULL) fica o valor debitado e em '*after' o estado
+final, ou o atual se o seqn nao era o esperado (retorna false sem alterar a conta).
+*/
+static bool account_advance(client_data *client, uint32_t seqn, uint32_t value,
+                            uint32_t *moved, uint64_t *after) {
+    uint64_t cur = account_state(client);
+    while (1) {
+        if (state_seqn(cur) + 1 != seqn) {
+            *after = cur;
+            return false;
+        }
+        uint32_t debit = (uint32_t)state_balance(cur) >= value ? value : 0;
+        uint64_t next = make_state(seqn, state_balance(cur) - (int32_t)debit);
+        if (atomic_compare_exchange_weak_explicit(&client->state, &cur, next,
+                                                  memory_order_acq_rel, memory_order_acquire)) {
+            if (moved) {*moved = debit;}
+            *after = next;
+            return true;
+        }
+    }
+}
+
+//credita 'value' na conta (com o client_lock da conta travado, exceto no modo -D)
+static inline void account_credit(client_data *client, uint32_t value) {
+    atomic_fetch_add_explicit(&client->state, value, memory_order_acq_rel);
+}
+
+//shard de estatisticas da thread atual, atribuido no primeiro uso
+static stats_shard *local_stats(void) {
+    if (my_stats_shard == NULL) {
+        uint32_t id = atomic_fetch_add(&stats_shards_used, 1);
+        //com mais threads que shards, alguns sao compartilhados (os incrementos sao atomicos)
+        my_stats_shard = &stats_shards[id % STATS_SHARDS];
+    }
+    return my_stats_shard;
+}
+
+//contabiliza uma transferencia bem-sucedida
+static void stats_add_transfer(uint32_t value) {
+    stats_shard *sh = local_stats();
+    atomic_fetch_add_explicit(&sh->num_transactions, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sh->total_transferred, value, memory_order_relaxed);
+}
+
+/*
+execucao particionada (-x): cada executor e dono exclusivo das contas com
+indice % num_executors == seu indice e as altera sem travas. creditos para contas de outra
+particao viram mensagens na caixa de saida do executor para aquela particao, aplicadas
+pelo dono ao fim da epoca (ver executor_thread).
+*/
+typedef struct {
+    int dest_idx;
+    uint32_t value;
+} credit_msg;
+
+typedef struct {
+    credit_msg *items;
+    size_t count;
+    size_t cap;
+} credit_vec;
+
+static int num_executors = 0;
+static __thread int my_partition = -1;          //particao da thread executora (-1 nos workers)
+static __thread credit_vec *my_outbox = NULL;   //caixas de saida do executor, uma por particao
+
+static inline int account_partition(int idx) {
+    return idx % num_executors;
+}
+
+//envia um credito para o dono de 'idx' (aplicado ao fim da epoca)
+static void post_credit(int idx, uint32_t value) {
+    credit_vec *cv = &my_outbox[account_partition(idx)];
+    if (cv->count == cv->cap) {
+        size_t cap = cv->cap ? cv->cap * 2 : 256;
+        credit_msg *items = realloc(cv->items, cap * sizeof(credit_msg));
+        if (items == NULL) {
+            perror("falha ao alocar mensagens de credito");
+            exit(EXIT_FAILURE);     //perder o credito quebraria o saldo total
+        }
+        cv->items = items;
+        cv->cap = cap;
+    }
+    cv->items[cv->count].dest_idx = idx;
+    cv->items[cv->count].value = value;
+    cv->count++;
+}
+
+/*
+creditos diferidos (-D): transferencias travam so a origem, ja que um credito nunca depende
+do saldo do destino, e o credito e um CAS direto no estado do destino. se o CAS falha, ha
+disputa real pela linha do saldo: a conta fica quente e ganha CREDIT_STRIPES contadores de
+delta, cada um em sua linha de cache, escolhidos pela thread. enquanto quente, os creditos
+para ela so somam no contador da thread. cada leitura do saldo (account_fold, sob a trava
+da origem) gasta um pouco do aquecimento; sem nova disputa a conta esfria em
+CREDIT_HOT_FOLDS leituras e os creditos voltam ao CAS. 'credits_dirty' evita percorrer os
+contadores quando nada foi somado neles desde a ultima incorporacao. debitos continuam
+checando o saldo completo. incompativel com o journal, cuja reaplicacao exige que cada
+credito seja ordenado com o 'last_lsn' do destino sob a trava dele.
+*/
+#define CREDIT_STRIPES 8
+#define CREDIT_HOT_FOLDS 64
+
+struct credit_stripe {
+    _Atomic int64_t delta;
+} __attribute__((aligned(CACHE_LINE)));
+
+static bool deferred_credits = false;
+
+//contadores de delta da conta, criados na primeira disputa pelo saldo
+static struct credit_stripe *credit_stripes(int idx) {
+    client_cold *cold = client_cold_at(idx);
+    struct credit_stripe *stripes = atomic_load_explicit(&cold->credits, memory_order_acquire);
+    if (stripes != NULL) {return stripes;}
+
+    struct credit_stripe *fresh = aligned_alloc(CACHE_LINE, CREDIT_STRIPES * sizeof(struct credit_stripe));
+    if (fresh == NULL) {return NULL;}
+    for (int i = 0; i < CREDIT_STRIPES; i++) {
+        atomic_init(&fresh[i].delta, 0);
+    }
+    if (!atomic_compare_exchange_strong_explicit(&cold->credits, &stripes, fresh,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        free(fresh);        //outra thread publicou primeiro: 'stripes' tem o vencedor
+        return stripes;
+    }
+    return fresh;
+}
+
+/*
+credita 'value' no destino de uma transferencia. sem -D o chamador ja tem a trava do
+destino; com -D o destino nao esta travado (ver acima). em um executor, contas de outra
+particao recebem o credito por mensagem.
+*/
+static void credit_account(int idx, uint32_t value) {
+    client_data *client = client_at(idx);
+    if (my_partition >= 0 && account_partition(idx) != my_partition) {
+        post_credit(idx, value);
+        return;
+    }
+    if (!deferred_credits) {
+        account_credit(client, value);
+        return;
+    }
+
+    client_cold *cold = client_cold_at(idx);
+    struct credit_stripe *stripes;
+    if (atomic_load_explicit(&cold->credit_heat, memory_order_acquire) == 0) {
+        uint64_t cur = account_state(client);
+        if (atomic_compare_exchange_strong_explicit(&client->state, &cur, cur + value,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            return;
+        }
+        //outra thread mexeu no saldo entre a leitura e o CAS: a conta esquenta
+        stripes = credit_stripes(idx);
+        if (stripes == NULL) {      //sem memoria: fica no credito atomico
+            account_credit(client, value);
+            return;
+        }
+        atomic_store_explicit(&cold->credit_heat, CREDIT_HOT_FOLDS, memory_order_release);
+    }
+    else {
+        stripes = atomic_load_explicit(&cold->credits, memory_order_acquire);
+    }
+
+    //soma antes de marcar: account_fold zera a marca antes de ler os contadores (seq_cst
+    //dos dois lados), entao um delta nunca fica sem marca e sem ser lido
+    uint32_t stripe = (uint32_t)(local_stats() - stats_shards) % CREDIT_STRIPES;
+    atomic_fetch_add_explicit(&stripes[stripe].delta, value, memory_order_seq_cst);
+    if (!atomic_load_explicit(&cold->credits_dirty, memory_order_seq_cst)) {
+        atomic_store_explicit(&cold->credits_dirty, true, memory_order_seq_cst);
+    }
+}
+
+//incorpora ao saldo os creditos diferidos da conta (com a trava da origem, antes de ler o saldo)
+static void account_fold(int idx) {
+    if (!deferred_credits) {return;}
+    client_cold *cold = client_cold_at(idx);
+    uint32_t heat = atomic_load_explicit(&cold->credit_heat, memory_order_relaxed);
+    if (heat > 0) {atomic_store_explicit(&cold->credit_heat, heat - 1, memory_order_relaxed);}
+    if (!atomic_load_explicit(&cold->credits_dirty, memory_order_seq_cst)) {return;}
+
+    atomic_store_explicit(&cold->credits_dirty, false, memory_order_seq_cst);
+    struct credit_stripe *stripes = atomic_load_explicit(&cold->credits, memory_order_acquire);
+    int64_t sum = 0;
+    for (int i = 0; i < CREDIT_STRIPES; i++) {
+        if (atomic_load_explicit(&stripes[i].delta, memory_order_seq_cst) != 0) {
+            sum += atomic_exchange_explicit(&stripes[i].delta, 0, memory_order_seq_cst);
+        }
+    }
+    if (sum != 0) {account_credit(client_at(idx), (uint32_t)sum);}
+}
+
+//creditos diferidos ainda nao incorporados (leitura sem trava: nao esvazia os contadores)
+static int64_t account_pending_credits(int idx) {
+    if (!deferred_credits) {return 0;}
+    struct credit_stripe *stripes = atomic_load_explicit(&client_cold_at(idx)->credits,
+                                                         memory_order_acquire);
+    if (stripes == NULL) {return 0;}
+
+    int64_t sum = 0;
+    for (int i = 0; i < CREDIT_STRIPES; i++) {
+        sum += atomic_load_explicit(&stripes[i].delta, memory_order_relaxed);
+    }
+    return sum;
+}
+
+//soma os shards em uso
+static void stats_collect(stats_snapshot *snap) {
+    uint32_t used = atomic_load_explicit(&stats_shards_used, memory_order_acquire);
+    if (used > STATS_SHARDS) {used = STATS_SHARDS;}
+
+    snap->num_transactions = 0;
+    snap->total_transferred = 0;
+    for (uint32_t i = 0; i < used; i++) {
+        snap->num_transactions += atomic_load_explicit(&stats_shards[i].num_transactions, memory_order_relaxed);
+        snap->total_transferred += atomic_load_explicit(&stats_shards[i].total_transferred, memory_order_relaxed);
+    }
+    snap->total_balance = atomic_load_explicit(&total_balance, memory_order_relaxed);
+}
+
+/*
+copia das estatisticas sem travas. os contadores so crescem, entao duas somas
+seguidas iguais correspondem a um estado que de fato existiu. sob escrita intensa
+desiste apos algumas tentativas e devolve a ultima soma.
+*/
+static void stats_read(stats_snapshot *snap) {
+    stats_collect(snap);
+    for (int i = 0; i < STATS_SNAPSHOT_TRIES; i++) {
+        stats_snapshot again;
+        stats_collect(&again);
+        if (memcmp(&again, snap, sizeof(again)) == 0) {return;}
+        *snap = again;
+    }
+}
+
+
+/*
+histogramas de desempenho no estilo HDR, divididos nos mesmos shards das estatisticas.
+valores abaixo de 2^HIST_SUB_BITS tem um balde cada; acima, cada potencia de 2 e dividida
+em 2^HIST_SUB_BITS baldes (erro relativo < 3,2%). registrar e um incremento atomico relaxado
+no shard da propria thread; leituras somam os shards, sem parar os workers.
+*/
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1u << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    _Atomic uint64_t counts[STATS_NUM_HISTS][HIST_BUCKETS];
+    _Atomic uint64_t max[STATS_NUM_HISTS];
+} __attribute__((aligned(CACHE_LINE))) hist_shard;
+
+static hist_shard hist_shards[STATS_SHARDS];
+
+//relogio monotonico em nanossegundos (latencias)
+static inline uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static size_t hist_index(uint64_t v) {
+    if (v < HIST_SUB) {return (size_t)v;}
+    int msb = 63 - __builtin_clzll(v);
+    size_t idx = (size_t)(msb - HIST_SUB_BITS + 1) * HIST_SUB + (size_t)((v >> (msb - HIST_SUB_BITS)) - HIST_SUB);
+    return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+//maior valor que cai no balde 'idx'
+static uint64_t hist_upper(size_t idx) {
+    if (idx < HIST_SUB) {return idx;}
+    size_t k = idx / HIST_SUB;
+    size_t r = idx % HIST_SUB;
+    return ((uint64_t)(HIST_SUB + r + 1) << (k - 1)) - 1;
+}
+
+static void hist_record(int hist, uint64_t v) {
+    hist_shard *sh = &hist_shards[local_stats() - stats_shards];
+    atomic_fetch_add_explicit(&sh->counts[hist][hist_index(v)], 1, memory_order_relaxed);
+
+    uint64_t max = atomic_load_explicit(&sh->max[hist], memory_order_relaxed);
+    while (v > max && !atomic_compare_exchange_weak_explicit(&sh->max[hist], &max, v,
+                memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+//soma os shards em uso e resume o histograma 'hist' (em ordem de rede)
+static void hist_summarize(int hist, stats_hist_summary *out) {
+    uint64_t counts[HIST_BUCKETS];
+    uint32_t used = atomic_load_explicit(&stats_shards_used, memory_order_acquire);
+    if (used > STATS_SHARDS) {used = STATS_SHARDS;}
+
+    uint64_t total = 0, max = 0;
+    memset(counts, 0, sizeof(counts));
+    for (uint32_t i = 0; i < used; i++) {
+        for (size_t b = 0; b < HIST_BUCKETS; b++) {
+            counts[b] += atomic_load_explicit(&hist_shards[i].counts[hist][b], memory_order_relaxed);
+        }
+        uint64_t m = atomic_load_explicit(&hist_shards[i].max[hist], memory_order_relaxed);
+        if (m > max) {max = m;}
+    }
+    for (size_t b = 0; b < HIST_BUCKETS; b++) {
+        total += counts[b];
+    }
+
+    const double pcts[4] = {50.0, 90.0, 99.0, 99.9};
+    uint64_t vals[4] = {0, 0, 0, 0};
+    for (int p = 0; p < 4 && total > 0; p++) {
+        uint64_t rank = (uint64_t)(pcts[p] / 100.0 * (double)total);
+        if (rank >= total) {rank = total - 1;}
+        uint64_t seen = 0;
+        for (size_t b = 0; b < HIST_BUCKETS; b++) {
+            seen += counts[b];
+            if (seen > rank) {
+                vals[p] = hist_upper(b) < max ? hist_upper(b) : max;
+                break;
+            }
+        }
+    }
+
+    out->count = htobe64(total);
+    out->p50 = htobe64(vals[0]);
+    out->p90 = htobe64(vals[1]);
+    out->p99 = htobe64(vals[2]);
+    out->p999 = htobe64(vals[3]);
+    out->max = htobe64(max);
+}
+
+
+/*
+sistema de log: anel pre-alocado de registros (varios produtores, um consumidor).
+cada slot tem um numero de sequencia que diz se esta livre para o produtor da volta
+'pos' (seq == pos) ou pronto para o escritor (seq == pos + 1). produtores reservam
+slots com CAS em 'log_tail' e nunca alocam memoria nem pegam trava no caminho comum.
+a thread de interface esvazia o anel em lotes com um unico writev.
+*/
+#define LOG_RING_CAP 16384              //potencia de 2
+#define LOG_WRITE_BATCH 64              //registros por writev (<= IOV_MAX)
+#define LOG_IDLE_WAIT_MS 50
+
+//politica quando o anel esta cheio
+typedef enum {
+    LOG_FULL_BLOCK,     //produtor espera espaco no anel
+    LOG_FULL_DROP,      //descarta o registro e contabiliza
+    LOG_FULL_SPILL      //aloca o registro em uma lista de transbordo
+} log_full_policy;
 
+typedef struct {
+    _Atomic size_t seq;
+    size_t len;                         //inclui o '\n' final
+    char text[LOG_MSG_LEN];
+} log_record;
 
-//nó de uma lista para a fila de logs
+//nó de uma lista para o transbordo do anel
 typedef struct log_node {
     char text[LOG_MSG_LEN];
+    size_t len;
     struct log_node *next;
 } log_node_t;
 
 //variaveis para sistema de log
-static log_node_t *log_head = NULL; 
-static log_node_t *log_tail = NULL;
-static pthread_mutex_t log_mutex;   //mutex para acessar fila de logs
+static log_record *log_ring = NULL;
+static _Atomic size_t log_tail = 0;         //proxima posicao a reservar (produtores)
+static size_t log_head = 0;                 //proxima posicao a escrever (somente a interface)
+static log_full_policy log_policy = LOG_FULL_SPILL;
+static _Atomic uint64_t log_dropped = 0;    //registros descartados pela politica LOG_FULL_DROP
+static _Atomic bool log_writer_idle = false;
+static _Atomic int log_blocked = 0;         //produtores esperando espaco (LOG_FULL_BLOCK)
+static log_node_t *spill_head = NULL;     //protegidos por spill_mutex
+static log_node_t *spill_tail = NULL;
+static pthread_mutex_t spill_mutex = PTHREAD_MUTEX_INITIALIZER;
+//houve transbordo e a interface ainda nao esvaziou a lista: os registros novos tambem
+//vao para a lista, para sairem depois dos que transbordaram (e na ordem original)
+static _Atomic bool spill_active = false;
+static pthread_mutex_t log_mutex;   //mutex das variaveis de condicao do log
 static pthread_cond_t  update_cond; //variavel de condicao para sinalizar para a thread de -
                                     //- interface que novos logs estao disponiveis
+static pthread_cond_t  space_cond;  //sinaliza produtores bloqueados que ha espaco no anel
+
+static int log_init(void) {
+    log_ring = calloc(LOG_RING_CAP, sizeof(log_record));
+    if (!log_ring) {return -1;}
+    for (size_t i = 0; i < LOG_RING_CAP; i++) {
+        atomic_init(&log_ring[i].seq, i);
+    }
+    if (pthread_mutex_init(&log_mutex, NULL) != 0 ||
+            pthread_cond_init(&update_cond, NULL) != 0 ||
+            pthread_cond_init(&space_cond, NULL) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+//acorda a interface se ela estiver dormindo
+static void wake_log_writer(void) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&log_writer_idle, memory_order_relaxed)) {
+        pthread_mutex_lock(&log_mutex);
+        pthread_cond_signal(&update_cond);
+        pthread_mutex_unlock(&log_mutex);
+    }
+}
+
+//guarda o registro na lista de transbordo (anel cheio, politica LOG_FULL_SPILL)
+static void spill_log(const char *txt, size_t len) {
+    log_node_t *n = malloc(sizeof(log_node_t));
+
+    if (!n) { //falha na alocação
+        atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    memcpy(n->text, txt, len);
+    n->text[len] = '\n';
+    n->len = len + 1;
+    n->next = NULL;
+
+    pthread_mutex_lock(&spill_mutex);
+    if (spill_tail) {
+        spill_tail->next = n;   //adicionado ao final
+    }
+    else {
+        spill_head = n;         //lista vazia
+    }
+    spill_tail = n;
+    atomic_store_explicit(&spill_active, true, memory_order_relaxed);
+    pthread_mutex_unlock(&spill_mutex);
+}
 
 /* 
-aloca um nó. copia a mensagem de log para ele. adiciona ao final da fila. sinaliza para a interface o novo item.
+reserva um slot no anel. copia a mensagem de log para ele. publica o slot e sinaliza
+para a interface, se ela estiver dormindo. com o anel cheio aplica 'log_policy'.
 */
 static void push_log(const char *txt) {
-    log_node_t *n = malloc(sizeof(log_node_t));
+    size_t len = strnlen(txt, LOG_MSG_LEN - 1);
+    size_t pos = atomic_load_explicit(&log_tail, memory_order_relaxed);
+    log_record *slot;
 
-    if (!n) {return;} //falha na alocação
+    if (log_policy == LOG_FULL_SPILL && atomic_load_explicit(&spill_active, memory_order_relaxed)) {
+        spill_log(txt, len);
+        wake_log_writer();
+        return;
+    }
 
-    strncpy(n->text, txt, LOG_MSG_LEN-1);
-    n->text[LOG_MSG_LEN-1] = '\0';
-    n->next = NULL;
+    while (1) {
+        slot = &log_ring[pos & (LOG_RING_CAP - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            //slot livre nesta volta: tenta reserva-lo
+            if (atomic_compare_exchange_weak_explicit(&log_tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            //anel cheio
+            if (log_policy == LOG_FULL_DROP) {
+                atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+                return;
+            }
+            if (log_policy == LOG_FULL_SPILL) {
+                spill_log(txt, len);
+                wake_log_writer();
+                return;
+            }
+
+            //LOG_FULL_BLOCK: espera a interface liberar espaco
+            wake_log_writer();
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 1000000;
+            if (ts.tv_nsec >= 1000000000) {ts.tv_sec++; ts.tv_nsec -= 1000000000;}
+            pthread_mutex_lock(&log_mutex);
+            atomic_fetch_add(&log_blocked, 1);
+            pthread_cond_timedwait(&space_cond, &log_mutex, &ts);
+            atomic_fetch_sub(&log_blocked, 1);
+            pthread_mutex_unlock(&log_mutex);
+            pos = atomic_load_explicit(&log_tail, memory_order_relaxed);
+        }
+        else {
+            //outro produtor reservou este slot
+            pos = atomic_load_explicit(&log_tail, memory_order_relaxed);
+        }
+    }
+
+    memcpy(slot->text, txt, len);
+    slot->text[len] = '\n';
+    slot->len = len + 1;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    wake_log_writer();
+}
+
+//escreve todos os iovecs, tratando escritas parciais
+static void write_all(struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t w = writev(STDOUT_FILENO, iov, cnt);
+        if (w < 0) {return;}   //saida indisponivel: descarta o lote
+        while (cnt > 0 && (size_t)w >= iov->iov_len) {
+            w -= (ssize_t)iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= (size_t)w;
+        }
+    }
+}
+
+//escreve um lote de registros prontos do anel. retorna quantos escreveu
+static size_t drain_ring(void) {
+    struct iovec iov[LOG_WRITE_BATCH];
+    size_t n = 0;
+
+    while (n < LOG_WRITE_BATCH) {
+        log_record *slot = &log_ring[(log_head + n) & (LOG_RING_CAP - 1)];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != log_head + n + 1) {break;}
+        iov[n].iov_base = slot->text;
+        iov[n].iov_len = slot->len;
+        n++;
+    }
+    if (n == 0) {return 0;}
+    hist_record(STATS_HIST_LOG_DEPTH, atomic_load_explicit(&log_tail, memory_order_relaxed) - log_head);
+
+    write_all(iov, (int)n);
+
+    //libera os slots para a proxima volta do anel
+    for (size_t i = 0; i < n; i++) {
+        log_record *slot = &log_ring[(log_head + i) & (LOG_RING_CAP - 1)];
+        atomic_store_explicit(&slot->seq, log_head + i + LOG_RING_CAP, memory_order_release);
+    }
+    log_head += n;
+
+    if (atomic_load(&log_blocked) > 0) {
+        pthread_mutex_lock(&log_mutex);
+        pthread_cond_broadcast(&space_cond);
+        pthread_mutex_unlock(&log_mutex);
+    }
+    return n;
+}
+
+//escreve os registros da lista de transbordo e o aviso de descartes. retorna se escreveu algo
+static bool drain_spill(void) {
+    static uint64_t reported_drops = 0;
+    bool wrote = false;
+
+    pthread_mutex_lock(&spill_mutex);
+    log_node_t *list = spill_head;
+    spill_head = spill_tail = NULL;
+    if (list == NULL) {
+        //lista vazia: o anel ja foi esvaziado antes, entao os produtores podem voltar a ele
+        atomic_store_explicit(&spill_active, false, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&spill_mutex);
+
+    while (list) {
+        struct iovec iov[LOG_WRITE_BATCH];
+        log_node_t *batch[LOG_WRITE_BATCH];
+        int n = 0;
+        while (list && n < LOG_WRITE_BATCH) {
+            batch[n] = list;
+            iov[n].iov_base = list->text;
+            iov[n].iov_len = list->len;
+            list = list->next;
+            n++;
+        }
+        write_all(iov, n);
+        for (int i = 0; i < n; i++) {
+            free(batch[i]);
+        }
+        wrote = true;
+    }
+
+    uint64_t drops = atomic_load_explicit(&log_dropped, memory_order_relaxed);
+    if (drops != reported_drops) {
+        char msg[LOG_MSG_LEN];
+        int len = snprintf(msg, sizeof(msg), "log: %llu registros descartados (anel cheio)\n",
+                           (unsigned long long)(drops - reported_drops));
+        struct iovec iov = { .iov_base = msg, .iov_len = (size_t)len };
+        write_all(&iov, 1);
+        reported_drops = drops;
+        wrote = true;
+    }
+    return wrote;
+}
+
+/*
+thread para imprimir logs.
+esvazia o anel em lotes de ate LOG_WRITE_BATCH registros por writev. quando nao ha
+nada pendente, marca-se ociosa e dorme em 'update_cond' ate um produtor acorda-la.
+registros que transbordaram do anel sao escritos depois dos que estavam no anel; enquanto
+a lista de transbordo nao se esvazia, os registros novos tambem vao para ela, entao a
+ordem entre registros de um mesmo produtor se mantem.
+*/
+static void *interface_thread(void *arg) {
+    (void)arg;                      //evitar "unused parameter"
+    while (1) {
+        size_t wrote = 0;
+        size_t n;
+        while ((n = drain_ring()) > 0) {
+            wrote += n;
+        }
+        if (drain_spill() || wrote > 0) {continue;}
+
+        //nada pendente: dorme ate um produtor sinalizar
+        pthread_mutex_lock(&log_mutex);
+        atomic_store(&log_writer_idle, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        log_record *next = &log_ring[log_head & (LOG_RING_CAP - 1)];
+        if (atomic_load_explicit(&next->seq, memory_order_acquire) != log_head + 1 &&
+                !atomic_load_explicit(&spill_active, memory_order_relaxed)) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += LOG_IDLE_WAIT_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000) {ts.tv_sec++; ts.tv_nsec -= 1000000000;}
+            //espera por novas atualizações (o timeout cobre sinais perdidos)
+            pthread_cond_timedwait(&update_cond, &log_mutex, &ts);
+        }
+        atomic_store(&log_writer_idle, false);
+        pthread_mutex_unlock(&log_mutex);
+    }
+    return NULL;
+}
+
+//estrutura com os dados de uma requisicao recebida
+typedef struct {
+    packet pkt;
+    struct sockaddr_in client_addr;
+    socklen_t len;
+    int sockfd;
+    batch_packet *batch;        //TYPE_BATCH_REQ: lote no pool do receptor, devolvido pelo worker
+    uint64_t recv_ns;           //instante da recepcao (histogramas de latencia)
+} request_data;
+
+//bytes de um datagrama de lote que nao cabem em 'pkt' (recebidos em um buffer a parte)
+#define BATCH_TAIL_SIZE (sizeof(batch_packet) - sizeof(packet))
+
+/*
+pool de buffers de lote de um receptor, alocado uma unica vez quando a thread de recepcao
+inicia. so o receptor retira buffers (lista livre propria, sem trava); quem termina de
+processar o lote (worker ou executor) o devolve empilhando-o em 'returned' com um CAS, e
+o receptor recolhe a pilha inteira de uma vez quando a sua lista acaba. como a pilha
+compartilhada nunca e desempilhada item a item, nao ha problema de ABA.
+*/
+#define BATCH_POOL_SIZE 1024    //lotes em processamento por receptor (alem disso, descarta)
+
+typedef struct batch_buf {
+    batch_packet pkt;           //primeiro campo: request_data.batch aponta para o buffer
+    struct batch_buf *next;
+    struct batch_pool *pool;    //pool de origem, para a devolucao
+} batch_buf;
+
+typedef struct batch_pool {
+    batch_buf *free_list;               //so o receptor mexe
+    _Atomic(batch_buf *) returned;      //devolvidos pelos workers e executores
+} batch_pool;
+
+static void batch_pool_init(batch_pool *pool) {
+    batch_buf *bufs = malloc(BATCH_POOL_SIZE * sizeof(batch_buf));
+    if (bufs == NULL) {
+        perror("falha ao alocar pool de lotes");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < BATCH_POOL_SIZE; i++) {
+        bufs[i].pool = pool;
+        bufs[i].next = i + 1 < BATCH_POOL_SIZE ? &bufs[i + 1] : NULL;
+    }
+    pool->free_list = bufs;
+    atomic_init(&pool->returned, NULL);
+}
+
+//retira um buffer (so o receptor dono). NULL se todos estiverem em uso
+static batch_buf *batch_pool_get(batch_pool *pool) {
+    if (pool->free_list == NULL) {
+        pool->free_list = atomic_exchange_explicit(&pool->returned, NULL, memory_order_acquire);
+        if (pool->free_list == NULL) {return NULL;}
+    }
+    batch_buf *buf = pool->free_list;
+    pool->free_list = buf->next;
+    return buf;
+}
+
+//devolve o lote de uma requisicao ao pool do seu receptor (qualquer thread; NULL e ignorado)
+static void batch_release(batch_packet *batch) {
+    if (batch == NULL) {return;}
+    batch_buf *buf = (batch_buf *)batch;
+    batch_buf *head = atomic_load_explicit(&buf->pool->returned, memory_order_relaxed);
+    do {
+        buf->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&buf->pool->returned, &head, buf,
+                                                    memory_order_release, memory_order_relaxed));
+}
 
-    pthread_mutex_lock(&log_mutex);
-    if (log_tail) {
-        log_tail->next = n;     //adicionado ao final
+/*
+completa os campos de lote de uma requisicao recebida em 'n' bytes: 'data->pkt' tem o
+inicio do datagrama e 'tail' o restante, copiados para um buffer do pool do receptor.
+retorna false se o lote estiver malformado (ou o pool estiver vazio), e entao o datagrama
+deve ser descartado.
+*/
+static bool attach_batch(batch_pool *pool, request_data *data, const char *tail, size_t n) {
+    data->batch = NULL;
+    if (ntohs(data->pkt.type) != TYPE_BATCH_REQ) {return true;}
+
+    if (n < offsetof(batch_packet, entries)) {return false;}
+    batch_buf *buf = batch_pool_get(pool);
+    if (buf == NULL) {return false;}    //sem ACK o cliente reenvia o lote
+    batch_packet *batch = &buf->pkt;
+
+    memcpy(batch, &data->pkt, n < sizeof(packet) ? n : sizeof(packet));
+    if (n > sizeof(packet)) {
+        memcpy((char *)batch + sizeof(packet), tail, n - sizeof(packet));
+    }
+
+    uint16_t count = ntohs(batch->count);
+    if (count == 0 || count > MAX_BATCH_ENTRIES ||
+            n < offsetof(batch_packet, entries) + count * sizeof(batch_entry)) {
+        buf->next = pool->free_list;
+        pool->free_list = buf;
+        return false;
+    }
+    data->batch = batch;
+    return true;
+}
+
+/*
+fila circular limitada de requisicoes (varios produtores, varios consumidores).
+os slots sao alocados uma unica vez na inicializacao; push e pop copiam o request_data.
+quando a fila enche o produtor bloqueia, e o excesso fica no buffer do socket.
+*/
+typedef struct {
+    request_data *slots;
+    size_t cap;
+    size_t head;                //proximo slot a ser consumido
+    size_t count;               //slots ocupados
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} request_queue;
+
+static request_queue req_queue;
+static size_t io_batch = 1;     //datagramas por chamada de recvmmsg/sendmmsg (1 = sem lote)
+
+static int queue_init(request_queue *q, size_t cap) {
+    q->slots = calloc(cap, sizeof(request_data));
+    if (!q->slots) {return -1;}
+    q->cap = cap;
+    q->head = 0;
+    q->count = 0;
+    if (pthread_mutex_init(&q->mutex, NULL) != 0 ||
+            pthread_cond_init(&q->not_empty, NULL) != 0 ||
+            pthread_cond_init(&q->not_full, NULL) != 0) {
+        free(q->slots);
+        return -1;
+    }
+    return 0;
+}
+
+//insere uma requisicao no fim da fila, esperando se estiver cheia
+static void queue_push(request_queue *q, const request_data *req) {
+    pthread_mutex_lock(&q->mutex);
+    while (q->count == q->cap) {
+        pthread_cond_wait(&q->not_full, &q->mutex);
+    }
+    q->slots[(q->head + q->count) % q->cap] = *req;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+//insere 'n' requisicoes de uma vez, adquirindo o mutex uma unica vez por bloco livre
+static void queue_push_batch(request_queue *q, const request_data *reqs, size_t n) {
+    size_t done = 0;
+    pthread_mutex_lock(&q->mutex);
+    while (done < n) {
+        while (q->count == q->cap) {
+            pthread_cond_wait(&q->not_full, &q->mutex);
+        }
+        while (done < n && q->count < q->cap) {
+            q->slots[(q->head + q->count) % q->cap] = reqs[done++];
+            q->count++;
+        }
+        pthread_cond_broadcast(&q->not_empty);
+    }
+    pthread_mutex_unlock(&q->mutex);
+}
+
+//retira ate 'max' requisicoes de uma vez, esperando se a fila estiver vazia. retorna quantas retirou
+static size_t queue_pop_batch(request_queue *q, request_data *out, size_t max) {
+    pthread_mutex_lock(&q->mutex);
+    while (q->count == 0) {
+        pthread_cond_wait(&q->not_empty, &q->mutex);
+    }
+    size_t depth = q->count;
+    size_t n = 0;
+    while (n < max && q->count > 0) {
+        out[n++] = q->slots[q->head];
+        q->head = (q->head + 1) % q->cap;
+        q->count--;
+    }
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->mutex);
+    hist_record(STATS_HIST_QUEUE_DEPTH, depth);
+    return n;
+}
+
+/*
+io_uring por syscalls diretas (sem liburing). cada anel pertence a uma unica thread:
+ela preenche SQEs, publica a cauda da fila de submissao e consome a fila de conclusao.
+so os indices compartilhados com o kernel precisam de acquire/release.
+*/
+typedef enum {
+    IO_THREADS,         //recvmsg/recvmmsg bloqueantes (padrao)
+    IO_EPOLL,           //epoll_wait + rajadas de recvmmsg com MSG_DONTWAIT
+    IO_URING            //recepcoes e envios em voo no io_uring
+} io_backend_t;
+
+static io_backend_t io_backend = IO_THREADS;
+
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sqe_tail;          //SQEs preenchidas (ainda nao publicadas ou ja submetidas)
+    unsigned sq_entries;
+} uring;
+
+static int uring_init(uring *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {return -1;}
+
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && cq_len > sq_len) {sq_len = cq_len;}
+
+    char *sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    r->fd, IORING_OFF_SQ_RING);
+    char *cq = single ? sq : mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                  r->fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        //desfaz os mapeamentos que deram certo (com 'single', cq e o proprio sq)
+        if (sq != MAP_FAILED) {munmap(sq, sq_len);}
+        if (!single && cq != MAP_FAILED) {munmap(cq, cq_len);}
+        if (sqes != MAP_FAILED) {munmap(sqes, p.sq_entries * sizeof(struct io_uring_sqe));}
+        close(r->fd);
+        return -1;
+    }
+
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->sqes = sqes;
+    r->sq_entries = p.sq_entries;
+    r->sqe_tail = *r->sq_tail;
+    return 0;
+}
+
+//proxima SQE livre (zerada), ou NULL se a fila de submissao estiver cheia
+static struct io_uring_sqe *uring_get_sqe(uring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sqe_tail - head >= r->sq_entries) {return NULL;}
+
+    unsigned idx = r->sqe_tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->sqe_tail++;
+    return sqe;
+}
+
+//publica as SQEs pendentes e, com 'wait_nr' > 0, espera essa quantidade de conclusoes
+static int uring_submit(uring *r, unsigned wait_nr) {
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    unsigned pending = r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (pending == 0 && wait_nr == 0) {return 0;}
+
+    int ret;
+    do {
+        ret = (int)syscall(__NR_io_uring_enter, r->fd, pending, wait_nr,
+                           wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+//erro de uring_submit: EAGAIN/EBUSY (sem recursos no momento) pode ser repetido; os demais encerram
+static void uring_check_submit(int ret) {
+    if (ret < 0 && errno != EAGAIN && errno != EBUSY) {
+        perror("io_uring_enter");
+        exit(EXIT_FAILURE);
+    }
+}
+
+//conclusao mais antiga ainda nao consumida, ou NULL
+static struct io_uring_cqe *uring_peek_cqe(uring *r) {
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {return NULL;}
+    return &r->cqes[head & *r->cq_mask];
+}
+
+static void uring_cqe_seen(uring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static void uring_prep_msg(struct io_uring_sqe *sqe, uint8_t op, int fd, struct msghdr *hdr,
+                           uint64_t user_data) {
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)hdr;
+    sqe->len = 1;
+    sqe->user_data = user_data;
+}
+
+/*
+envio das respostas de um worker pelo io_uring: cada resposta ocupa um slot (pacote,
+endereco e msghdr estaveis ate a conclusao) e vira uma SQE de sendmsg. o lote inteiro
+sai em um unico io_uring_enter, sem esperar as conclusoes; os slots sao recolhidos nas
+proximas chamadas, e so se espera o kernel quando nenhum slot estiver livre.
+*/
+#define TX_SLOTS 256
+
+typedef struct {
+    packet pkt;
+    struct sockaddr_in addr;
+    struct iovec iov;
+    struct msghdr hdr;
+} tx_slot;
+
+typedef struct {
+    uring ring;
+    unsigned num_free;
+    unsigned free_slots[TX_SLOTS];
+    tx_slot slots[TX_SLOTS];
+} tx_uring;
+
+static __thread tx_uring *my_tx = NULL;    //NULL: envia com sendmmsg
+
+static tx_uring *tx_uring_create(void) {
+    tx_uring *tx = calloc(1, sizeof(tx_uring));
+    if (!tx) {return NULL;}
+    if (uring_init(&tx->ring, TX_SLOTS) != 0) {
+        free(tx);
+        return NULL;
+    }
+    for (unsigned i = 0; i < TX_SLOTS; i++) {
+        tx->free_slots[i] = i;
+    }
+    tx->num_free = TX_SLOTS;
+    return tx;
+}
+
+//devolve os slots de envios ja concluidos; com 'wait', espera ao menos uma conclusao
+static void tx_uring_reap(tx_uring *tx, bool wait) {
+    if (wait && uring_peek_cqe(&tx->ring) == NULL) {
+        uring_check_submit(uring_submit(&tx->ring, 1));
+    }
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(&tx->ring)) != NULL) {
+        tx->free_slots[tx->num_free++] = (unsigned)cqe->user_data;  //erro de envio: o cliente retransmite
+        uring_cqe_seen(&tx->ring);
+    }
+}
+
+static void tx_uring_send(tx_uring *tx, int fd, const struct sockaddr_in *addr, socklen_t len,
+                          const packet *reply) {
+    while (tx->num_free == 0) {
+        tx_uring_reap(tx, true);
+    }
+    unsigned idx = tx->free_slots[--tx->num_free];
+    tx_slot *slot = &tx->slots[idx];
+    slot->pkt = *reply;
+    slot->addr = *addr;
+    slot->iov.iov_base = &slot->pkt;
+    slot->iov.iov_len = sizeof(packet);
+    memset(&slot->hdr, 0, sizeof(slot->hdr));
+    slot->hdr.msg_name = &slot->addr;
+    slot->hdr.msg_namelen = len;
+    slot->hdr.msg_iov = &slot->iov;
+    slot->hdr.msg_iovlen = 1;
+
+    //cada slot em uso tem no maximo uma SQE, entao a fila de submissao nunca enche
+    struct io_uring_sqe *sqe = uring_get_sqe(&tx->ring);
+    uring_prep_msg(sqe, IORING_OP_SENDMSG, fd, &slot->hdr, idx);
+}
+
+/*
+respostas acumuladas por um worker durante um lote de requisicoes.
+sao enviadas com um unico sendmmsg por socket em 'flush_replies' (ou, com o
+backend io_uring, em um unico io_uring_enter).
+*/
+typedef struct {
+    size_t count;
+    size_t cap;                                 //1 = envia cada resposta imediatamente
+    packet pkts[MAX_IO_BATCH];
+    struct sockaddr_in addrs[MAX_IO_BATCH];
+    socklen_t lens[MAX_IO_BATCH];
+    int fds[MAX_IO_BATCH];
+} reply_batch;
+
+//envia todas as respostas pendentes, agrupando sequencias com o mesmo socket
+static void flush_replies(reply_batch *out) {
+    if (my_tx) {
+        for (size_t i = 0; i < out->count; i++) {
+            tx_uring_send(my_tx, out->fds[i], &out->addrs[i], out->lens[i], &out->pkts[i]);
+        }
+        uring_check_submit(uring_submit(&my_tx->ring, 0));
+        tx_uring_reap(my_tx, false);
+        out->count = 0;
+        return;
+    }
+
+    struct mmsghdr msgs[MAX_IO_BATCH];
+    struct iovec iovs[MAX_IO_BATCH];
+    size_t start = 0;
+
+    while (start < out->count) {
+        size_t end = start;
+        while (end < out->count && out->fds[end] == out->fds[start]) {
+            iovs[end].iov_base = &out->pkts[end];
+            iovs[end].iov_len = sizeof(packet);
+            memset(&msgs[end], 0, sizeof(struct mmsghdr));
+            msgs[end].msg_hdr.msg_name = &out->addrs[end];
+            msgs[end].msg_hdr.msg_namelen = out->lens[end];
+            msgs[end].msg_hdr.msg_iov = &iovs[end];
+            msgs[end].msg_hdr.msg_iovlen = 1;
+            end++;
+        }
+
+        //sendmmsg pode enviar menos mensagens que o pedido; reenvia o restante
+        size_t sent = start;
+        while (sent < end) {
+            int r = sendmmsg(out->fds[start], &msgs[sent], (unsigned int)(end - sent), 0);
+            if (r <= 0) {break;}   //erro de envio: o cliente retransmite
+            sent += (size_t)r;
+        }
+        start = end;
+    }
+    out->count = 0;
+}
+
+//enfileira uma resposta para 'addr', a ser enviada pelo socket 'fd'
+static void batch_reply(reply_batch *out, int fd, const struct sockaddr_in *addr, socklen_t len,
+                        const packet *reply) {
+    if (out->cap <= 1) {
+        sendto(fd, reply, sizeof(packet), 0, (const struct sockaddr *)addr, len);
+        return;
+    }
+    out->pkts[out->count] = *reply;
+    out->addrs[out->count] = *addr;
+    out->lens[out->count] = len;
+    out->fds[out->count] = fd;
+    out->count++;
+    if (out->count == out->cap) {
+        flush_replies(out);
+    }
+}
+
+//enfileira a resposta para o remetente da requisicao
+static void send_reply(reply_batch *out, const request_data *data, const packet *reply) {
+    batch_reply(out, data->sockfd, &data->client_addr, data->len, reply);
+}
+
+/*
+indice hash (enderecamento aberto, sondagem linear) das contas.
+mapeia in_addr.s_addr -> indice da conta. a capacidade e sempre potencia de 2
+e dobra quando a ocupacao passa de metade.
+
+leituras nao usam trava: cada entrada e uma palavra atomica de 64 bits (ip << 32 | idx+1,
+0 = vazia) e a tabela corrente e publicada por ponteiro atomico, no estilo RCU.
+o registro de clientes, sob 'client_table_mutex', e o unico escritor. ao crescer, a tabela
+nova e montada por completo antes de ser publicada; a antiga e mantida ate o fim do
+processo, pois leitores podem ainda estar sondando nela (o total retido e menor que a
+tabela corrente).
+*/
+#define INDEX_INITIAL_CAP 64
+
+typedef struct index_table {
+    size_t cap;
+    struct index_table *retired;        //tabela anterior, liberada somente no encerramento
+    _Atomic uint64_t slots[];
+} index_table;
+
+static _Atomic(index_table *) client_index = NULL;
+static size_t index_used = 0;           //somente o escritor acessa
+
+//mistura os bits do endereco (finalizador do murmur3) para espalhar ips sequenciais
+static inline uint32_t hash_addr(uint32_t key) {
+    key ^= key >> 16;
+    key *= 0x85ebca6bu;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35u;
+    key ^= key >> 16;
+    return key;
+}
+
+//procura 'key' no indice sem travas. retorna o indice do cliente ou -1
+static int index_lookup(uint32_t key) {
+    index_table *t = atomic_load_explicit(&client_index, memory_order_acquire);
+    if (t == NULL) {return -1;}
+
+    size_t mask = t->cap - 1;
+    for (size_t pos = hash_addr(key) & mask; ; pos = (pos + 1) & mask) {
+        //acquire: a conta apontada foi inicializada antes da publicacao da entrada
+        uint64_t e = atomic_load_explicit(&t->slots[pos], memory_order_acquire);
+        if (e == 0) {return -1;}
+        if ((uint32_t)(e >> 32) == key) {return (int)(uint32_t)e - 1;}
+    }
+}
+
+//insere sem verificar capacidade (ha sempre slots vazios, ocupacao <= 1/2)
+static void index_put(index_table *t, uint64_t entry) {
+    size_t mask = t->cap - 1;
+    size_t pos = hash_addr((uint32_t)(entry >> 32)) & mask;
+    while (atomic_load_explicit(&t->slots[pos], memory_order_relaxed) != 0) {
+        pos = (pos + 1) & mask;
+    }
+    atomic_store_explicit(&t->slots[pos], entry, memory_order_release);
+}
+
+//adiciona 'key' -> 'idx' ao indice, dobrando a tabela quando necessario. somente sob client_table_mutex
+static int index_insert(uint32_t key, int32_t idx) {
+    index_table *cur = atomic_load_explicit(&client_index, memory_order_relaxed);
+    size_t cap = cur ? cur->cap : 0;
+
+    if ((index_used + 1) * 2 > cap) {
+        size_t new_cap = cap ? cap * 2 : INDEX_INITIAL_CAP;
+        index_table *t = calloc(1, sizeof(index_table) + new_cap * sizeof(uint64_t));
+        if (!t) {return -1;}
+        t->cap = new_cap;
+        t->retired = cur;
+
+        //reinsere as entradas existentes e so entao publica a tabela nova
+        for (size_t i = 0; i < cap; i++) {
+            uint64_t e = atomic_load_explicit(&cur->slots[i], memory_order_relaxed);
+            if (e != 0) {
+                index_put(t, e);
+            }
+        }
+        atomic_store_explicit(&client_index, t, memory_order_release);
+        cur = t;
+    }
+
+    index_put(cur, ((uint64_t)key << 32) | (uint32_t)(idx + 1));
+    index_used++;
+    return 0;
+}
+
+//libera a tabela corrente e todas as aposentadas (somente no encerramento)
+static void index_free(void) {
+    index_table *t = atomic_exchange(&client_index, NULL);
+    while (t) {
+        index_table *prev = t->retired;
+        free(t);
+        t = prev;
+    }
+}
+
+//encontra o indice de um cliente na tabela pelo seu endereco
+int find_client(struct sockaddr_in* cliaddr) {
+    return index_lookup(cliaddr->sin_addr.s_addr);
+}
+
+//encontra o destino da transferencia
+int find_client_ip(struct in_addr ip_addr) {
+    return index_lookup(ip_addr.s_addr);
+}
+
+/*
+cria a conta de 'ip' em 'client_table'. inicializa seu saldo. sera seu 'seqn'. inicializa seu mutex.
+deve ser chamada sob 'client_table_mutex' (ou antes dos workers existirem); a conta so
+fica visivel para as buscas depois de totalmente inicializada. retorna o indice ou -1.
+*/
+static int create_account(struct in_addr ip) {
+    int new_client_id = num_clients;
+    int chunk = new_client_id >> CLIENT_CHUNK_BITS;
+
+    if (chunk >= MAX_CLIENT_CHUNKS) {return -1;}   //diretorio cheio
+
+    //primeira conta do bloco: aloca o bloco inteiro (alinhado a linha de cache) e seus campos frios
+    if (client_table[chunk] == NULL) {
+        client_data *hot = aligned_alloc(CACHE_LINE, CLIENT_CHUNK_SIZE * sizeof(client_data));
+        client_cold *cold = calloc(CLIENT_CHUNK_SIZE, sizeof(client_cold));
+        if (hot == NULL || cold == NULL) {
+            free(hot);
+            free(cold);
+            return -1;
+        }
+        memset(hot, 0, CLIENT_CHUNK_SIZE * sizeof(client_data));
+        client_cold_table[chunk] = cold;
+        client_table[chunk] = hot;
+    }
+
+    client_data *client = client_at(new_client_id);
+    atomic_init(&client->state, make_state(0, INITIAL_BALANCE));
+    client->pending = NULL;
+    client_cold_at(new_client_id)->client_ip = ip;
+    client_cold_at(new_client_id)->last_lsn = 0;
+    atomic_init(&client->last_ack, make_state(0, INITIAL_BALANCE));
+
+    //mutex especifico do cliente
+    if (pthread_mutex_init(&client->client_lock, NULL) != 0) {
+        return -1; 
+    }
+
+    //torna o cliente visivel nas buscas
+    if (index_insert(ip.s_addr, new_client_id) != 0) {
+        pthread_mutex_destroy(&client->client_lock);
+        return -1;
+    }
+
+    num_clients++;
+    atomic_fetch_add_explicit(&total_balance, INITIAL_BALANCE, memory_order_relaxed);
+    return new_client_id;
+}
+
+/*
+registra um novo cliente
+cria sua conta e loga o registro com as estatisticas globais. deve ser chamada sob
+'client_table_mutex'.
+*/
+int register_new_client(struct sockaddr_in* cliaddr) {
+    int new_client_id = create_account(cliaddr->sin_addr);
+    if (new_client_id == -1) {return -1;}
+
+    stats_snapshot st;
+    stats_read(&st);
+    
+    //loga o registro do novo cliente
+    char time_str[100];
+    char logbuf[LOG_MSG_LEN];
+    get_current_time(time_str, sizeof(time_str));
+    snprintf(logbuf, sizeof(logbuf),
+             "%s client %s id req 0 dest 0 value 0 num_transactions %u total_transferred %u total_balance %u",
+             time_str,
+             inet_ntoa(cliaddr->sin_addr),
+             st.num_transactions,
+             st.total_transferred,
+             st.total_balance);
+    push_log(logbuf);        
+    return new_client_id;
+}
+
+/*
+cache da data/hora formatada. o texto so muda uma vez por segundo, entao a primeira
+thread que percebe a virada do segundo o reformata e as demais apenas copiam.
+protegido por um seqlock: 'seq' impar indica atualizacao em andamento, e o leitor
+repete a copia se 'seq' mudou durante ela. ninguem espera: se outra thread estiver
+atualizando, o leitor formata a propria copia. os campos sao atomicos relaxados (o texto
+copiado palavra a palavra) para que a leitura concorrente com a escrita nao seja uma
+corrida de dados; a consistencia vem do seqlock. o cache so avanca: uma thread que ainda
+formata um segundo antigo nao sobrescreve um segundo mais novo ja publicado.
+*/
+#define TIME_STR_LEN 32
+#define TIME_STR_WORDS (TIME_STR_LEN / sizeof(uint64_t))
+
+static struct {
+    _Atomic uint32_t seq;
+    _Atomic int64_t sec;                        //segundo que 'text' representa
+    _Atomic uint64_t text[TIME_STR_WORDS];
+} time_cache;
+
+static bool time_millis = false;    //acrescenta milissegundos aos timestamps (-m)
+
+static void format_time(time_t sec, char *buffer, size_t buffer_size) {
+    struct tm t;
+    localtime_r(&sec, &t);
+    strftime(buffer, buffer_size, "%Y-%m-%d %H:%M:%S", &t);
+}
+
+// obtem a data/hora formatada
+void get_current_time(char* buffer, size_t buffer_size) {
+    struct timespec now;
+    uint64_t words[TIME_STR_WORDS];
+    char *text = (char *)words;
+    bool hit = false;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    uint32_t seq = atomic_load_explicit(&time_cache.seq, memory_order_acquire);
+    if ((seq & 1) == 0 && atomic_load_explicit(&time_cache.sec, memory_order_relaxed) == now.tv_sec) {
+        for (size_t i = 0; i < TIME_STR_WORDS; i++) {
+            words[i] = atomic_load_explicit(&time_cache.text[i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        hit = atomic_load_explicit(&time_cache.seq, memory_order_relaxed) == seq;
+    }
+
+    if (!hit) {
+        format_time(now.tv_sec, text, sizeof(words));
+
+        //tenta publicar o novo segundo; se outra thread ja esta atualizando, segue com a copia local
+        if ((seq & 1) == 0 && atomic_compare_exchange_strong(&time_cache.seq, &seq, seq + 1)) {
+            atomic_thread_fence(memory_order_release);     //'seq' impar visivel antes dos campos
+            if (now.tv_sec > atomic_load_explicit(&time_cache.sec, memory_order_relaxed)) {
+                atomic_store_explicit(&time_cache.sec, now.tv_sec, memory_order_relaxed);
+                for (size_t i = 0; i < TIME_STR_WORDS; i++) {
+                    atomic_store_explicit(&time_cache.text[i], words[i], memory_order_relaxed);
+                }
+            }
+            atomic_store_explicit(&time_cache.seq, seq + 2, memory_order_release);
+        }
+    }
+
+    if (time_millis) {
+        snprintf(buffer, buffer_size, "%s.%03ld", text, now.tv_nsec / 1000000);
+    }
+    else {
+        snprintf(buffer, buffer_size, "%s", text);
+    }
+}
+
+
+
+/*
+journal de escrita antecipada (WAL): arquivo binario somente-acrescimo com um registro
+de tamanho fixo por efeito aplicado a 'client_table' (registro de cliente ou requisicao
+processada). os registros sao escritos por process_request sob as travas das contas
+envolvidas, entao a ordem dos LSNs respeita a ordem de aplicacao.
+
+commit em grupo: os workers apenas copiam o registro e o ACK correspondente para o lote
+corrente. a thread do journal troca o lote, escreve tudo com um write, faz um unico
+fdatasync e so entao envia os ACKs do lote. assim o cliente so recebe confirmacao de
+transferencias duraveis, ao custo de um fsync por lote e nao por transacao.
+*/
+#define JOURNAL_MAGIC 0x4a584950u       //"PIXJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_BATCH_MAX 4096          //registros/respostas por lote
+
+enum {
+    JOURNAL_REG = 1,    //cliente registrado (origin)
+    JOURNAL_REQ = 2     //requisicao processada: origin.last_req = seqn, 'value' movido para dest
+                        //(dest = 0: destino inexistente, so consome o seqn)
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+} journal_header;
+
+typedef struct {
+    uint64_t lsn;           //numero de sequencia do log, contiguo a partir de 1
+    uint32_t type;
+    uint32_t origin;        //s_addr da conta de origem
+    uint32_t dest;          //s_addr da conta de destino
+    uint32_t seqn;
+    uint32_t value;         //valor efetivamente transferido (0 para consultas e falhas)
+    uint32_t checksum;      //FNV-1a dos campos anteriores; detecta registros rasgados
+} journal_record;
+
+//resposta que so pode sair depois que o lote do seu registro for duravel
+typedef struct {
+    packet pkt;
+    batch_ack *batch;       //se nao for NULL, envia este ACK de lote (liberado apos o envio)
+    size_t batch_len;
+    struct sockaddr_in addr;
+    socklen_t len;
+    int fd;
+} pending_reply;
+
+typedef struct {
+    journal_record *records;
+    size_t num_records;
+    pending_reply *replies;
+    size_t num_replies;
+} journal_batch;
+
+static int journal_fd = -1;                     //-1 = journal desligado
+static long journal_window_us = 0;              //espera extra para acumular o lote (-g)
+static journal_batch journal_batches[2];
+static journal_batch *journal_active = &journal_batches[0];
+static uint64_t journal_next_lsn = 1;
+static _Atomic uint64_t journal_durable_lsn = 0;
+
+//estatisticas derivadas somente dos registros duraveis (para o snapshot), sob journal_mutex
+static uint64_t journal_stats_lsn = 0;
+static uint32_t journal_stats_transactions = 0;
+static uint32_t journal_stats_transferred = 0;
+static pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t journal_ready_cond = PTHREAD_COND_INITIALIZER;   //ha algo no lote
+static pthread_cond_t journal_space_cond = PTHREAD_COND_INITIALIZER;   //o lote foi trocado
+
+static uint32_t journal_checksum(const journal_record *rec) {
+    const unsigned char *p = (const unsigned char *)rec;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < offsetof(journal_record, checksum); i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+static bool journal_enabled(void) {
+    return journal_fd >= 0;
+}
+
+/*
+copia o registro 'rec' (pode ser NULL) e a resposta 'reply' para o lote corrente.
+respostas sem registro entram no lote para nao passarem na frente de um registro anterior
+ainda nao duravel (ex.: reenvio do ACK de uma requisicao do lote em andamento).
+'batch' (de 'batch_len' bytes, alocado pelo chamador) substitui 'reply' para ACKs de lote.
+espera se o lote estiver cheio. retorna o LSN atribuido ao registro (0 se nao houver).
+*/
+static uint64_t journal_append(journal_record *rec, int fd, const struct sockaddr_in *addr,
+                               socklen_t len, const packet *reply, batch_ack *batch, size_t batch_len) {
+    uint64_t lsn = 0;
+
+    pthread_mutex_lock(&journal_mutex);
+    while (journal_active->num_records == JOURNAL_BATCH_MAX ||
+            journal_active->num_replies == JOURNAL_BATCH_MAX) {
+        pthread_cond_wait(&journal_space_cond, &journal_mutex);
+    }
+
+    bool was_empty = journal_active->num_records == 0 && journal_active->num_replies == 0;
+    if (rec) {
+        lsn = journal_next_lsn++;
+        rec->lsn = lsn;
+        rec->checksum = journal_checksum(rec);
+        journal_active->records[journal_active->num_records++] = *rec;
+    }
+    if (reply || batch) {
+        pending_reply *p = &journal_active->replies[journal_active->num_replies++];
+        if (reply) {p->pkt = *reply;}
+        p->batch = batch;
+        p->batch_len = batch_len;
+        p->addr = *addr;
+        p->len = len;
+        p->fd = fd;
+    }
+    if (was_empty) {
+        pthread_cond_signal(&journal_ready_cond);
+    }
+    pthread_mutex_unlock(&journal_mutex);
+    return lsn;
+}
+
+/*
+envia a resposta de uma requisicao que alterou (ou consultou) o estado das contas.
+com o journal ligado, registra 'rec' e adia a resposta ate o lote ser duravel.
+retorna o LSN do registro (0 sem journal), que o chamador grava em 'last_lsn' das contas.
+*/
+static uint64_t commit_reply(reply_batch *out, const request_data *data, const packet *reply,
+                             journal_record *rec) {
+    if (!journal_enabled()) {
+        send_reply(out, data, reply);
+        return 0;
+    }
+    return journal_append(rec, data->sockfd, &data->client_addr, data->len, reply, NULL, 0);
+}
+
+//como commit_reply, para o ACK de um lote (os registros das entradas ja foram anexados)
+static void commit_batch_ack(const request_data *data, const batch_ack *ack, size_t ack_len) {
+    if (!journal_enabled()) {
+        sendto(data->sockfd, ack, ack_len, 0, (const struct sockaddr *)&data->client_addr, data->len);
+        return;
+    }
+    batch_ack *copy = malloc(ack_len);
+    if (copy == NULL) {return;}     //sem ACK o cliente reenvia e recebe os resultados como duplicatas
+    memcpy(copy, ack, ack_len);
+    journal_append(NULL, data->sockfd, &data->client_addr, data->len, NULL, copy, ack_len);
+}
+
+//escreve todo o buffer, tratando escritas parciais
+static int write_full(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) {return -1;}
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+/*
+thread do journal: commit em grupo.
+espera haver algo no lote corrente, troca os lotes (os workers seguem acumulando no outro),
+escreve e sincroniza os registros e entao envia as respostas que esperavam por eles.
+*/
+static void *journal_thread(void *arg) {
+    (void)arg;
+    reply_batch out;
+    out.count = 0;
+    out.cap = MAX_IO_BATCH;
+
+    while (1) {
+        pthread_mutex_lock(&journal_mutex);
+        while (journal_active->num_records == 0 && journal_active->num_replies == 0) {
+            pthread_cond_wait(&journal_ready_cond, &journal_mutex);
+        }
+        if (journal_window_us > 0) {
+            //janela de agrupamento: deixa o lote crescer um pouco antes de sincronizar
+            pthread_mutex_unlock(&journal_mutex);
+            usleep((useconds_t)journal_window_us);
+            pthread_mutex_lock(&journal_mutex);
+        }
+        journal_batch *batch = journal_active;
+        journal_active = (batch == &journal_batches[0]) ? &journal_batches[1] : &journal_batches[0];
+        pthread_cond_broadcast(&journal_space_cond);
+        pthread_mutex_unlock(&journal_mutex);
+
+        if (batch->num_records > 0) {
+            if (write_full(journal_fd, batch->records, batch->num_records * sizeof(journal_record)) != 0 ||
+                    fdatasync(journal_fd) != 0) {
+                //sem durabilidade nao ha como confirmar nada: melhor parar do que mentir ao cliente
+                perror("falha ao gravar o journal");
+                exit(EXIT_FAILURE);
+            }
+            atomic_store_explicit(&journal_durable_lsn, batch->records[batch->num_records - 1].lsn,
+                                  memory_order_release);
+
+            uint32_t txs = 0, transferred = 0;
+            for (size_t i = 0; i < batch->num_records; i++) {
+                if (batch->records[i].value > 0) {
+                    txs++;
+                    transferred += batch->records[i].value;
+                }
+            }
+            pthread_mutex_lock(&journal_mutex);
+            journal_stats_lsn = batch->records[batch->num_records - 1].lsn;
+            journal_stats_transactions += txs;
+            journal_stats_transferred += transferred;
+            pthread_mutex_unlock(&journal_mutex);
+        }
+
+        for (size_t i = 0; i < batch->num_replies; i++) {
+            pending_reply *p = &batch->replies[i];
+            if (p->batch) {
+                sendto(p->fd, p->batch, p->batch_len, 0, (const struct sockaddr *)&p->addr, p->len);
+                free(p->batch);
+                continue;
+            }
+            batch_reply(&out, p->fd, &p->addr, p->len, &p->pkt);
+        }
+        flush_replies(&out);
+
+        batch->num_records = 0;
+        batch->num_replies = 0;
+    }
+    return NULL;
+}
+
+/*
+reaplica um registro do journal as contas (na inicializacao, antes dos workers).
+cada conta guarda o LSN do ultimo registro que a alterou: efeitos de registros com LSN
+menor ou igual ja estao nela (vieram do snapshot) e sao ignorados. estatisticas sao
+somadas apenas para registros posteriores a 'stats_lsn' do snapshot.
+*/
+static void journal_apply(const journal_record *rec, uint64_t stats_lsn) {
+    struct in_addr ip;
+    ip.s_addr = rec->origin;
+    int origin_idx = find_client_ip(ip);
+    if (origin_idx == -1) {
+        origin_idx = create_account(ip);
+    }
+    if (rec->type != JOURNAL_REQ || origin_idx == -1) {return;}
+
+    client_data *origin = client_at(origin_idx);
+    if (rec->dest == 0) {
+        //requisicao para destino inexistente: so consumiu o seqn
+        if (rec->lsn > client_cold_at(origin_idx)->last_lsn) {
+            atomic_store(&origin->state, make_state(rec->seqn, state_balance(account_state(origin))));
+            client_cold_at(origin_idx)->last_lsn = rec->lsn;
+        }
+        return;
+    }
+
+    //o destino pode ter sido registrado com LSN maior que o de uma transferencia para ele
+    ip.s_addr = rec->dest;
+    int dest_idx = find_client_ip(ip);
+    if (dest_idx == -1) {
+        dest_idx = create_account(ip);
+    }
+    if (dest_idx == -1) {return;}
+
+    client_data *dest = client_at(dest_idx);
+    if (rec->lsn > client_cold_at(origin_idx)->last_lsn) {
+        int32_t balance = state_balance(account_state(origin)) - (int32_t)rec->value;
+        atomic_store(&origin->state, make_state(rec->seqn, balance));
+        client_cold_at(origin_idx)->last_lsn = rec->lsn;
+    }
+    if (rec->value > 0 && rec->lsn > client_cold_at(dest_idx)->last_lsn) {
+        account_credit(dest, rec->value);
+        client_cold_at(dest_idx)->last_lsn = rec->lsn;
+    }
+    if (rec->value > 0 && rec->lsn > stats_lsn) {
+        stats_add_transfer(rec->value);
+    }
+}
+
+/*
+abre (ou cria) o journal em 'path' e reaplica os registros validos a partir do LSN
+'first_lsn' (1 sem snapshot). como os registros tem tamanho fixo e LSNs contiguos, o
+inicio da cauda e localizado por posicao, sem ler o historico anterior. um registro com
+checksum ou LSN invalido marca o fim do log (escrita interrompida por queda): o arquivo
+e truncado nesse ponto e os novos registros continuam dali. retorna 0 ou -1.
+*/
+static int journal_open(const char *path, uint64_t first_lsn, uint64_t stats_lsn) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("falha ao abrir o journal");
+        return -1;
+    }
+
+    journal_header hdr;
+    ssize_t n = read(fd, &hdr, sizeof(hdr));
+    if (n == 0) {
+        //arquivo novo
+        hdr.magic = JOURNAL_MAGIC;
+        hdr.version = JOURNAL_VERSION;
+        hdr.record_size = sizeof(journal_record);
+        hdr.reserved = 0;
+        if (write_full(fd, &hdr, sizeof(hdr)) != 0 || fdatasync(fd) != 0) {
+            perror("falha ao inicializar o journal");
+            close(fd);
+            return -1;
+        }
+    }
+    else if (n != (ssize_t)sizeof(hdr) || hdr.magic != JOURNAL_MAGIC ||
+             hdr.version != JOURNAL_VERSION || hdr.record_size != sizeof(journal_record)) {
+        fprintf(stderr, "journal %s invalido ou de versao incompativel\n", path);
+        close(fd);
+        return -1;
+    }
+
+    //posiciona no inicio da cauda e reaplica os registros
+    journal_record rec;
+    journal_next_lsn = first_lsn;
+    off_t valid_end = (off_t)(sizeof(hdr) + (first_lsn - 1) * sizeof(journal_record));
+    if (lseek(fd, valid_end, SEEK_SET) < 0) {
+        perror("falha ao posicionar o journal");
+        close(fd);
+        return -1;
+    }
+    while (read(fd, &rec, sizeof(rec)) == (ssize_t)sizeof(rec)) {
+        if (rec.lsn != journal_next_lsn || rec.checksum != journal_checksum(&rec)) {break;}
+        journal_apply(&rec, stats_lsn);
+        journal_next_lsn++;
+        valid_end += (off_t)sizeof(rec);
+    }
+
+    //o snapshot cobre LSNs que ja deveriam estar no journal
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size < valid_end) {
+        fprintf(stderr, "journal %s e mais curto que o snapshot\n", path);
+        close(fd);
+        return -1;
+    }
+    if (ftruncate(fd, valid_end) != 0 || lseek(fd, valid_end, SEEK_SET) < 0) {
+        perror("falha ao posicionar o journal");
+        close(fd);
+        return -1;
+    }
+    atomic_store(&journal_durable_lsn, journal_next_lsn - 1);
+    stats_snapshot st;
+    stats_read(&st);
+    journal_stats_lsn = journal_next_lsn - 1;
+    journal_stats_transactions = st.num_transactions;
+    journal_stats_transferred = st.total_transferred;
+
+    for (int i = 0; i < 2; i++) {
+        journal_batches[i].records = malloc(JOURNAL_BATCH_MAX * sizeof(journal_record));
+        journal_batches[i].replies = malloc(JOURNAL_BATCH_MAX * sizeof(pending_reply));
+        journal_batches[i].num_records = 0;
+        journal_batches[i].num_replies = 0;
+        if (!journal_batches[i].records || !journal_batches[i].replies) {
+            perror("falha ao alocar lotes do journal");
+            close(fd);
+            return -1;
+        }
+    }
+
+    journal_fd = fd;
+    return 0;
+}
+
+
+/*
+snapshot da tabela de contas em arquivo mapeado em memoria.
+a thread de snapshot copia periodicamente cada conta (sob a trava daquela conta apenas,
+sem parar os workers) para um arquivo temporario mapeado, espera o journal tornar
+duraveis todos os LSNs que a copia reflete e o renomeia por cima do anterior.
+a copia e "difusa" (cada conta e capturada em um instante diferente); por isso cada conta
+leva seu 'last_lsn', e na reinicializacao a cauda do journal a partir de 'start_lsn'
+e reaplicada conta a conta so onde o registro e mais novo que a copia. o tempo de
+reinicio fica limitado pelo periodo do snapshot, e nao pelo tamanho do historico.
+*/
+#define SNAPSHOT_MAGIC 0x53584950u      //"PIXS"
+#define SNAPSHOT_VERSION 1
+#define DEFAULT_SNAPSHOT_PERIOD 60      //segundos
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t start_lsn;             //todo registro com LSN <= start_lsn esta refletido na copia
+    uint64_t stats_lsn;             //LSN a que as estatisticas abaixo correspondem
+    uint64_t num_accounts;
+    uint32_t num_transactions;
+    uint32_t total_transferred;
+} snapshot_header;
+
+typedef struct {
+    uint32_t ip;
+    uint32_t last_req;
+    int32_t balance;
+    uint32_t reserved;
+    uint64_t last_lsn;
+} snapshot_account;
+
+static const char *snapshot_path = NULL;
+static int snapshot_period = DEFAULT_SNAPSHOT_PERIOD;
+
+//grava um snapshot completo. retorna 0 ou -1
+static int snapshot_write(void) {
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", snapshot_path);
+
+    //tudo abaixo de start_lsn ja foi aplicado as contas (o LSN e atribuido apos a aplicacao)
+    pthread_mutex_lock(&journal_mutex);
+    uint64_t start_lsn = journal_next_lsn - 1;
+    pthread_mutex_unlock(&journal_mutex);
+
+    //contas registradas depois daqui aparecem na cauda do journal
+    pthread_mutex_lock(&client_table_mutex);
+    int n = num_clients;
+    pthread_mutex_unlock(&client_table_mutex);
+
+    size_t size = sizeof(snapshot_header) + (size_t)n * sizeof(snapshot_account);
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {return -1;}
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    snapshot_header *hdr = map;
+    snapshot_account *accounts = (snapshot_account *)(hdr + 1);
+    uint64_t max_lsn = start_lsn;
+    for (int i = 0; i < n; i++) {
+        client_data *c = client_at(i);
+        pthread_mutex_lock(&c->client_lock);
+        accounts[i].ip = client_cold_at(i)->client_ip.s_addr;
+        uint64_t state = account_state(c);     //consultas avancam o seqn mesmo sem a trava
+        accounts[i].last_req = state_seqn(state);
+        accounts[i].balance = state_balance(state);
+        accounts[i].reserved = 0;
+        accounts[i].last_lsn = client_cold_at(i)->last_lsn;
+        pthread_mutex_unlock(&c->client_lock);
+        if (accounts[i].last_lsn > max_lsn) {max_lsn = accounts[i].last_lsn;}
+    }
+
+    //a copia nao pode refletir efeitos que o journal ainda pode perder
+    while (atomic_load_explicit(&journal_durable_lsn, memory_order_acquire) < max_lsn) {
+        usleep(1000);
+    }
+
+    pthread_mutex_lock(&journal_mutex);
+    hdr->stats_lsn = journal_stats_lsn;
+    hdr->num_transactions = journal_stats_transactions;
+    hdr->total_transferred = journal_stats_transferred;
+    pthread_mutex_unlock(&journal_mutex);
+    hdr->start_lsn = start_lsn;
+    hdr->num_accounts = (uint64_t)n;
+    hdr->version = SNAPSHOT_VERSION;
+    hdr->magic = SNAPSHOT_MAGIC;
+
+    int rc = (msync(map, size, MS_SYNC) == 0 && fsync(fd) == 0) ? 0 : -1;
+    munmap(map, size);
+    close(fd);
+
+    //troca atomica: um snapshot incompleto nunca substitui o anterior
+    if (rc == 0 && rename(tmp_path, snapshot_path) != 0) {rc = -1;}
+    return rc;
+}
+
+//thread que grava um snapshot a cada 'snapshot_period' segundos
+static void *snapshot_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        sleep((unsigned int)snapshot_period);
+        if (snapshot_write() != 0) {
+            perror("falha ao gravar snapshot");
+        }
+    }
+    return NULL;
+}
+
+/*
+carrega o snapshot, se existir, mapeando o arquivo e recriando as contas.
+preenche o LSN a partir do qual o journal deve ser reaplicado e o das estatisticas.
+retorna 0 (com ou sem snapshot) ou -1 se o arquivo existir mas for invalido.
+*/
+static int snapshot_load(uint64_t *first_lsn, uint64_t *stats_lsn) {
+    *first_lsn = 1;
+    *stats_lsn = 0;
+
+    int fd = open(snapshot_path, O_RDONLY);
+    if (fd < 0) {return 0;}     //primeira execucao
+
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(snapshot_header)) {
+        fprintf(stderr, "snapshot %s invalido\n", snapshot_path);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("falha ao mapear snapshot");
+        return -1;
+    }
+
+    const snapshot_header *hdr = map;
+    const snapshot_account *accounts = (const snapshot_account *)(hdr + 1);
+    if (hdr->magic != SNAPSHOT_MAGIC || hdr->version != SNAPSHOT_VERSION ||
+            (size_t)sb.st_size != sizeof(snapshot_header) + hdr->num_accounts * sizeof(snapshot_account)) {
+        fprintf(stderr, "snapshot %s invalido ou de versao incompativel\n", snapshot_path);
+        munmap(map, (size_t)sb.st_size);
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < hdr->num_accounts; i++) {
+        struct in_addr ip;
+        ip.s_addr = accounts[i].ip;
+        int idx = create_account(ip);
+        if (idx == -1) {
+            munmap(map, (size_t)sb.st_size);
+            return -1;
+        }
+        client_data *c = client_at(idx);
+        atomic_store(&c->state, make_state(accounts[i].last_req, accounts[i].balance));
+        client_cold_at(idx)->last_lsn = accounts[i].last_lsn;
+    }
+
+    //as estatisticas do snapshot entram pelo shard da thread principal
+    stats_shard *sh = local_stats();
+    atomic_fetch_add(&sh->num_transactions, hdr->num_transactions);
+    atomic_fetch_add(&sh->total_transferred, hdr->total_transferred);
+
+    *first_lsn = (hdr->start_lsn < hdr->stats_lsn ? hdr->start_lsn : hdr->stats_lsn) + 1;
+    *stats_lsn = hdr->stats_lsn;
+    munmap(map, (size_t)sb.st_size);
+    return 0;
+}
+
+/*
+trava a conta medindo a espera (so chama o relogio se a trava estiver ocupada).
+executores nao travam: cada conta so e tocada pela thread dona da sua particao.
+*/
+static void lock_account(client_data *client) {
+    if (my_partition >= 0) {return;}
+    if (pthread_mutex_trylock(&client->client_lock) == 0) {
+        hist_record(STATS_HIST_LOCK_WAIT, 0);
+        return;
+    }
+    uint64_t start = mono_ns();
+    pthread_mutex_lock(&client->client_lock);
+    hist_record(STATS_HIST_LOCK_WAIT, mono_ns() - start);
+}
+
+static inline void unlock_account(client_data *client) {
+    if (my_partition < 0) {pthread_mutex_unlock(&client->client_lock);}
+}
+
+/*
+cache da ultima resposta da conta: 'state' logo apos o avanco do seqn, publicado depois de
+a resposta ser enviada ou anexada ao journal. duplicatas sao respondidas a partir dele sem
+trava (ou, com journal, no mesmo lote de commit da resposta original). consultas publicam
+sem a trava da conta, entao so um seqn maior que o publicado substitui o cache.
+*/
+static inline void publish_last_ack(client_data *client, uint64_t state) {
+    uint64_t cur = atomic_load_explicit(&client->last_ack, memory_order_relaxed);
+    while (state_seqn(cur) < state_seqn(state) &&
+           !atomic_compare_exchange_weak_explicit(&client->last_ack, &cur, state,
+                                                  memory_order_release, memory_order_relaxed)) {}
+}
+
+/*
+buffer de reordenacao de uma conta: requisicoes com seqn entre last_req+2 e
+last_req+REORDER_WINDOW ficam guardadas (posicao seqn % REORDER_WINDOW) ate a lacuna
+ser preenchida, e entao sao aplicadas em ordem. assim um pacote perdido nao obriga o
+cliente a retransmitir toda a janela. protegido pelo client_lock da conta.
+*/
+struct reorder_buffer {
+    uint32_t count;                         //posicoes ocupadas
+    bool used[REORDER_WINDOW];
+    request_data reqs[REORDER_WINDOW];
+};
+
+/*
+guarda uma requisicao futura da conta (chamada com o client_lock da conta travado).
+retorna false se o seqn esta alem da janela ou se nao ha memoria para o buffer.
+*/
+static bool reorder_hold(client_data *client, const request_data *data, uint32_t seqn) {
+    if (seqn - state_seqn(account_state(client)) > REORDER_WINDOW) {return false;}
+
+    if (client->pending == NULL) {
+        client->pending = calloc(1, sizeof(struct reorder_buffer));
+        if (client->pending == NULL) {return false;}
+    }
+
+    struct reorder_buffer *rb = client->pending;
+    uint32_t slot = seqn % REORDER_WINDOW;
+    if (!rb->used[slot]) {
+        rb->used[slot] = true;
+        rb->count++;
+    }
+    rb->reqs[slot] = *data;     //uma retransmissao so sobrescreve a copia anterior
+    return true;
+}
+
+/*
+retira do buffer da conta a requisicao seguinte a last_req, se ela ja chegou.
+posicoes que ficaram para tras (seqns ja processados por outra copia) sao descartadas.
+*/
+static bool reorder_take(int client_idx, request_data *next) {
+    client_data *client = client_at(client_idx);
+    bool found = false;
+
+    lock_account(client);
+    struct reorder_buffer *rb = client->pending;
+    if (rb != NULL && rb->count > 0) {
+        uint32_t expected = state_seqn(account_state(client)) + 1;
+        for (uint32_t slot = 0; slot < REORDER_WINDOW; slot++) {
+            if (!rb->used[slot]) {continue;}
+            uint32_t s = ntohl(rb->reqs[slot].pkt.seqn);
+            if (s == expected) {
+                *next = rb->reqs[slot];
+                found = true;
+            }
+            else if (s > expected) {continue;}
+            rb->used[slot] = false;
+            rb->count--;
+        }
+    }
+    unlock_account(client);
+    return found;
+}
+
+/*
+reenvia o ACK da ultima requisicao processada da conta, a partir do cache (sem trava).
+usado para duplicatas e pacotes fora de ordem: o ACK repetido avisa o cliente da lacuna.
+*/
+static void reack_last(reply_batch *out, request_data *data, client_data *client) {
+    uint64_t last = atomic_load_explicit(&client->last_ack, memory_order_acquire);
+    packet ack_pkt;
+    memset(&ack_pkt, 0, sizeof(packet));
+    ack_pkt.type = htons(TYPE_ACK_REQ);
+    ack_pkt.balance = htonl((uint32_t)last);                //saldo informado no ultimo ACK
+    ack_pkt.seqn = htonl((uint32_t)(last >> 32));           //seqn do ultimo ACK
+    commit_reply(out, data, &ack_pkt, NULL);
+}
+
+//loga uma requisicao duplicada (seqn <= last_req) como "DUP!!"
+static void log_duplicate(const struct sockaddr_in *client_addr, const packet *pkt) {
+    char logbuf[LOG_MSG_LEN];
+    char time_str[100];
+    char ip_origin[INET_ADDRSTRLEN];
+    char ip_dest[INET_ADDRSTRLEN];
+
+    get_current_time(time_str, sizeof(time_str));
+    strcpy(ip_origin, inet_ntoa(client_addr->sin_addr));
+    strcpy(ip_dest, inet_ntoa(pkt->dest_addr));
+    stats_snapshot st;
+    stats_read(&st);
+    snprintf(logbuf, sizeof(logbuf),
+             "%s client %s DUP!! id req %u dest %s value %u num_transactions %u total_transferred %u total_balance %u",
+             time_str, ip_origin, ntohl(pkt->seqn), ip_dest, ntohl(pkt->value),
+             st.num_transactions, st.total_transferred, st.total_balance);
+    push_log(logbuf);
+}
+
+/*
+aplica um lote de transferencias (TYPE_BATCH_REQ) de uma mesma origem.
+a origem e todos os destinos sao travados uma unica vez, em ordem crescente de indice
+como no caso simples, e as entradas sao aplicadas em ordem com as mesmas regras de seqn.
+responde com um unico ACK com o resultado de cada entrada. retorna o indice da origem.
+*/
+//responde um lote de origem desconhecida: todas as entradas falham, sem tocar em contas
+static void reject_batch(const request_data *data) {
+    batch_packet *bp = data->batch;
+    uint16_t count = ntohs(bp->count);
+
+    batch_ack ack;
+    ack.type = htons(TYPE_ACK_BATCH);
+    ack.count = htons(count);
+    size_t ack_len = offsetof(batch_ack, results) + count * sizeof(batch_result);
+    memset(ack.results, 0, count * sizeof(batch_result));
+    for (uint16_t i = 0; i < count; i++) {
+        ack.results[i].seqn = bp->entries[i].seqn;
+        ack.results[i].type = htons(TYPE_ERROR_REQ);
+    }
+    commit_batch_ack(data, &ack, ack_len);
+}
+
+static int apply_batch(request_data *data) {
+    batch_packet *bp = data->batch;
+    uint16_t count = ntohs(bp->count);
+    int origin_idx = find_client(&data->client_addr);
+
+    if (origin_idx == -1) {     //origem desconhecida: todas as entradas falham
+        reject_batch(data);
+        return -1;
+    }
+
+    batch_ack ack;
+    ack.type = htons(TYPE_ACK_BATCH);
+    ack.count = htons(count);
+    size_t ack_len = offsetof(batch_ack, results) + count * sizeof(batch_result);
+    memset(ack.results, 0, count * sizeof(batch_result));
+
+    //contas envolvidas, ordenadas e sem repeticao, para travar cada uma uma vez so
+    int dest_idx[MAX_BATCH_ENTRIES];
+    int locks[MAX_BATCH_ENTRIES + 1];
+    int num_locks = 0;
+    locks[num_locks++] = origin_idx;     //com creditos diferidos, so a origem
+    for (uint16_t i = 0; i < count; i++) {
+        dest_idx[i] = find_client_ip(bp->entries[i].dest_addr);
+        if (dest_idx[i] != -1 && !deferred_credits) {locks[num_locks++] = dest_idx[i];}
+    }
+    for (int i = 1; i < num_locks; i++) {       //insercao: no maximo 65 contas
+        int v = locks[i];
+        int j = i - 1;
+        while (j >= 0 && locks[j] > v) {
+            locks[j + 1] = locks[j];
+            j--;
+        }
+        locks[j + 1] = v;
+    }
+    int unique = 0;
+    for (int i = 0; i < num_locks; i++) {
+        if (unique == 0 || locks[unique - 1] != locks[i]) {locks[unique++] = locks[i];}
+    }
+    num_locks = unique;
+
+    for (int i = 0; i < num_locks; i++) {
+        lock_account(client_at(locks[i]));
+    }
+
+    account_fold(origin_idx);
+    client_data *origin = client_at(origin_idx);
+    uint64_t last_state = 0;        //estado apos a ultima entrada aplicada (seqn 0: nenhuma)
+    char logbuf[LOG_MSG_LEN];
+    char time_str[100];
+    char ip_origin[INET_ADDRSTRLEN];
+    char ip_dest[INET_ADDRSTRLEN];
+    strcpy(ip_origin, inet_ntoa(data->client_addr.sin_addr));
+
+    for (uint16_t i = 0; i < count; i++) {
+        batch_entry *e = &bp->entries[i];
+        batch_result *r = &ack.results[i];
+        uint32_t seqn = ntohl(e->seqn);
+        uint32_t value = ntohl(e->value);
+        r->seqn = e->seqn;
+
+        //auto-transferencias e destinos desconhecidos so consomem o seqn
+        uint32_t debit = (dest_idx[i] != -1 && dest_idx[i] != origin_idx) ? value : 0;
+        uint32_t moved = 0;
+        uint64_t after;
+        if (!account_advance(origin, seqn, debit, &moved, &after)) {
+            //duplicata: ja processada, informa o saldo atual; fora de ordem: type 0
+            if (seqn <= state_seqn(after)) {r->type = htons(TYPE_ACK_REQ);}
+            r->balance = htonl((uint32_t)state_balance(after));
+            continue;
+        }
+        last_state = after;
+
+        journal_record rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.type = JOURNAL_REQ;
+        rec.origin = data->client_addr.sin_addr.s_addr;
+        rec.seqn = seqn;
+
+        if (dest_idx[i] == -1) {    //destino desconhecido: consome o seqn, como no caso simples
+            r->type = htons(TYPE_ERROR_REQ);
+        }
+        else {
+            rec.dest = e->dest_addr.s_addr;
+            if (moved > 0) {
+                credit_account(dest_idx[i], moved);
+                rec.value = moved;
+                stats_add_transfer(moved);
+            }
+            r->type = htons(TYPE_ACK_REQ);
+
+            stats_snapshot st;
+            stats_read(&st);
+            get_current_time(time_str, sizeof(time_str));
+            strcpy(ip_dest, inet_ntoa(e->dest_addr));
+            snprintf(logbuf, sizeof(logbuf),
+                     "%s client %s id req %u dest %s value %u num_transactions %u total_transferred %u total_balance %u",
+                     time_str, ip_origin, seqn, ip_dest, value,
+                     st.num_transactions, st.total_transferred, st.total_balance);
+            push_log(logbuf);
+        }
+        r->balance = htonl((uint32_t)state_balance(after));
+
+        if (journal_enabled()) {
+            uint64_t lsn = journal_append(&rec, 0, NULL, 0, NULL, NULL, 0);
+            client_cold_at(origin_idx)->last_lsn = lsn;
+            if (rec.value > 0) {client_cold_at(dest_idx[i])->last_lsn = lsn;}
+        }
+    }
+
+    //o ACK entra no journal antes de soltar as travas, depois dos registros das entradas
+    commit_batch_ack(data, &ack, ack_len);
+    publish_last_ack(origin, last_state);
+
+    for (int i = num_locks - 1; i >= 0; i--) {
+        unlock_account(client_at(locks[i]));
+    }
+    return origin_idx;
+}
+
+/*
+conclui uma requisicao aplicada (seqn avancado, 'moved' ja transferido): loga, responde
+com o saldo de 'after' e grava o registro no journal. as consultas de saldo passam por
+aqui com moved = 0 e produzem a mesma linha de log e o mesmo ACK.
+*/
+static void finish_request(request_data *data, reply_batch *out, int origin_idx, int dest_idx,
+                           uint32_t moved, uint64_t after) {
+    char logbuf[LOG_MSG_LEN];
+    char time_str[100];
+    char ip_origin[INET_ADDRSTRLEN];
+    char ip_dest[INET_ADDRSTRLEN];
+    uint32_t seqn = ntohl(data->pkt.seqn);
+
+    //pega estatisticas para o log (mesmo se a transacao falhou por saldo)
+    stats_snapshot st;
+    stats_read(&st);
+
+    //loga a tentativa de transferencia
+    get_current_time(time_str, sizeof(time_str));
+    strcpy(ip_origin, inet_ntoa(data->client_addr.sin_addr));
+    strcpy(ip_dest, inet_ntoa(data->pkt.dest_addr));
+
+    snprintf(logbuf, sizeof(logbuf),
+             "%s client %s id req %u dest %s value %u num_transactions %u total_transferred %u total_balance %u",
+             time_str, ip_origin, seqn, ip_dest, ntohl(data->pkt.value),
+             st.num_transactions, st.total_transferred, st.total_balance);
+    push_log(logbuf);
+
+    //envia ACK para a requisição processada (com sucesso ou falha)
+    packet ack_pkt;
+    memset(&ack_pkt, 0, sizeof(packet));
+    ack_pkt.type = htons(TYPE_ACK_REQ);
+    ack_pkt.balance = htonl((uint32_t)state_balance(after));  // o novo saldo (ou o antigo se falhou)
+    ack_pkt.seqn = htonl(seqn);                                 // confirma o seqn da requisicao
+    journal_record rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.type = JOURNAL_REQ;
+    rec.origin = data->client_addr.sin_addr.s_addr;
+    rec.dest = data->pkt.dest_addr.s_addr;
+    rec.seqn = seqn;
+    rec.value = moved;
+    uint64_t lsn = commit_reply(out, data, &ack_pkt, &rec);
+    if (lsn) {
+        client_cold_at(origin_idx)->last_lsn = lsn;
+        if (moved > 0) {client_cold_at(dest_idx)->last_lsn = lsn;}
+    }
+    publish_last_ack(client_at(origin_idx), after);
+}
+
+/*
+consulta de saldo (valor 0) com o seqn esperado: so avanca o seqn da origem com um CAS
+no seu estado, sem trava nenhuma, e responde com o saldo lido no mesmo CAS. o destino
+nunca e travado. com journal, a trava da origem e mantida para que os registros de uma
+conta entrem no journal na ordem em que o seqn avancou (a reaplicacao depende disso).
+retorna false, sem efeito, se o seqn nao for o esperado (o chamador segue pelo caminho
+com travas, que trata duplicatas e pacotes fora de ordem).
+*/
+static bool apply_query(request_data *data, reply_batch *out, int origin_idx, int dest_idx) {
+    client_data *origin = client_at(origin_idx);
+    bool locked = journal_enabled();
+    uint64_t after;
+
+    if (locked) {lock_account(origin);}
+    bool applied = account_advance(origin, ntohl(data->pkt.seqn), 0, NULL, &after);
+    if (applied) {
+        //-D: os creditos diferidos entram so na resposta; incorpora-los exigiria a trava
+        //da origem, que um debito concorrente pode estar usando
+        int64_t pending = account_pending_credits(origin_idx);
+        if (pending != 0) {after = make_state(state_seqn(after), state_balance(after) + (int32_t)pending);}
+        finish_request(data, out, origin_idx, dest_idx, 0, after);
+    }
+    if (locked) {unlock_account(origin);}
+    return applied;
+}
+
+/*
+aplica uma requisicao ja retirada da fila (ou do buffer de reordenacao).
+retorna o indice da conta de origem de uma requisicao de transacao, para o chamador
+drenar o buffer de reordenacao dela, ou -1.
+*/
+static int apply_request(request_data* data, reply_batch *out) {
+
+    //recupera os dados da requisicao
+    packet pkt = data->pkt;
+    struct sockaddr_in client_addr = data->client_addr;
+    
+    //buffers para logs
+    char logbuf[LOG_MSG_LEN];
+    char time_str[100];
+    char ip_origin[INET_ADDRSTRLEN];
+    char ip_dest[INET_ADDRSTRLEN];
+
+    //lógica de descoberta
+    if (ntohs(pkt.type) == TYPE_DESCOBERTA) {
+        bool registered = false;
+
+        //cliente ja conhecido: nao precisa da trava de registro
+        if (find_client(&client_addr) == -1) {
+            pthread_mutex_lock(&client_table_mutex);        //trava registros e confere de novo
+            if (find_client(&client_addr) == -1) {
+                registered = register_new_client(&client_addr) != -1;  //registro de cliente novo
+            }
+            pthread_mutex_unlock(&client_table_mutex);
+        }
+
+        //responde com ACK de descoberta (apos o registro ser duravel, se houver journal)
+        packet ack_pkt;
+        memset(&ack_pkt, 0, sizeof(packet));
+        ack_pkt.type = htons(TYPE_ACK_DESCOBERTA);
+        journal_record rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.type = JOURNAL_REG;
+        rec.origin = client_addr.sin_addr.s_addr;
+        commit_reply(out, data, &ack_pkt, registered ? &rec : NULL);
+    }
+    
+    //lógica de requisição
+    else if (ntohs(pkt.type) == TYPE_REQ) {
+        uint32_t seqn = ntohl(pkt.seqn);
+        uint32_t value = ntohl(pkt.value);
+
+        //busca IDs dos clientes de origem e destino (leitura sem trava do indice)
+        int origin_idx = find_client(&client_addr);
+        int dest_idx = find_client_ip(pkt.dest_addr);
+
+        if (origin_idx == -1) { //cliente de origem ou destino desconhecido
+            packet error_pkt;
+            memset(&error_pkt, 0, sizeof(packet));
+            error_pkt.type = htons(TYPE_ERROR_REQ);
+            send_reply(out, data, &error_pkt);
+            
+        }
+        
+        else if (dest_idx == -1) {    //cliente de destino não existe
+            /*
+            a requisicao com destino invalido consome o seqn, como o cliente ja supoe
+            (ele passa ao seqn seguinte apos um erro); sem isso todas as proximas seriam
+            tratadas como fora de ordem. o erro leva o seqn para o cliente saber qual falhou.
+            */
+            client_data *origin = client_at(origin_idx);
+            lock_account(origin);
+
+            packet reply_pkt;
+            memset(&reply_pkt, 0, sizeof(packet));
+            uint64_t after;
+            if (account_advance(origin, seqn, 0, NULL, &after)) {
+                reply_pkt.type = htons(TYPE_ERROR_REQ);
+                reply_pkt.seqn = htonl(seqn);
+                journal_record rec;
+                memset(&rec, 0, sizeof(rec));
+                rec.type = JOURNAL_REQ;
+                rec.origin = client_addr.sin_addr.s_addr;
+                rec.seqn = seqn;        //dest = 0: so avanca o seqn da origem
+                uint64_t lsn = commit_reply(out, data, &reply_pkt, &rec);
+                if (lsn) {client_cold_at(origin_idx)->last_lsn = lsn;}
+                publish_last_ack(origin, after);
+            }
+            else if (seqn <= state_seqn(after)) {
+                //duplicata de uma requisicao que ja falhou
+                reply_pkt.type = htons(TYPE_ERROR_REQ);
+                reply_pkt.seqn = htonl(seqn);
+                commit_reply(out, data, &reply_pkt, NULL);
+            }
+            else {
+                //fora de ordem: guarda para depois e reenvia o ACK da ultima processada
+                reorder_hold(origin, data, seqn);
+                reack_last(out, data, origin);
+            }
+            unlock_account(origin);
+        } 
+        
+        /*
+        duplicata (retransmissao de uma requisicao ja respondida): responde com a ultima
+        resposta da conta, sem travar origem nem destino. seqns so crescem, entao um seqn
+        ate o publicado em last_ack ja foi processado.
+        */
+        else if (seqn <= state_seqn(atomic_load_explicit(&client_at(origin_idx)->last_ack,
+                                                         memory_order_acquire))) {
+            log_duplicate(&client_addr, &pkt);
+            reack_last(out, data, client_at(origin_idx));
+        }
+
+        //consulta de saldo com o seqn esperado: sem trava (ver apply_query)
+        else if (value == 0 && apply_query(data, out, origin_idx, dest_idx)) {}
+
+        else {
+            //lógica de travamento
+            bool self_transfer = (origin_idx == dest_idx);
+            bool lock_dest = !self_transfer && !deferred_credits;  //-D: so a origem (ver credit_account)
+            int lock1_idx = origin_idx;
+            int lock2_idx = dest_idx;
+            
+            //garante que o mutex com indice menor seja travado primeiro (evita deadlock)
+            if (lock_dest) {
+                lock1_idx = (origin_idx < dest_idx) ? origin_idx : dest_idx;
+                lock2_idx = (origin_idx > dest_idx) ? origin_idx : dest_idx;
+            }
+
+            //bloqueia mutex clientes
+            lock_account(client_at(lock1_idx));
+            if (lock_dest) {
+                lock_account(client_at(lock2_idx));
+            }
+            
+            //seção critica clientes
+            account_fold(origin_idx);
+            client_data *origin = client_at(origin_idx);
+            uint32_t moved = 0;   //valor efetivamente transferido (0 com saldo insuficiente)
+            uint64_t after;
+
+            //Pacote novo e esperado: avanca o seqn e debita a origem (auto-transferencia nao faz nada)
+            if (account_advance(origin, seqn, self_transfer ? 0 : value, &moved, &after)) {
+                if (moved > 0) {
+                    credit_account(dest_idx, moved);
+
+                    //atualiza estatisticas globais (transferencia bem-sucedida)
+                    stats_add_transfer(moved);
+                }
+                finish_request(data, out, origin_idx, dest_idx, moved, after);
+            }
+
+            //pacote duplicado (seqn <= last_req) ou pacote fora de ordem (seqn > expected_seqn)
+            else {
+
+                //duplicata que chegou junto com a resposta original: loga como "DUP!!"
+                if (seqn <= state_seqn(after)) {
+                    log_duplicate(&client_addr, &pkt);
+                } 
+                
+                //se for fora de ordem (pacote do futuro) dentro da janela, guarda para
+                //aplicar quando a lacuna for preenchida; alem dela, loga normalmente e descarta
+                else if (!reorder_hold(origin, data, seqn)) {
+                    get_current_time(time_str, sizeof(time_str));
+                    strcpy(ip_origin, inet_ntoa(client_addr.sin_addr));
+                    strcpy(ip_dest, inet_ntoa(pkt.dest_addr));
+                    stats_snapshot st;
+                    stats_read(&st);
+                    
+                    snprintf(logbuf, sizeof(logbuf),
+                             "%s client %s id req %u dest %s value %u num_transactions %u total_transferred %u total_balance %u",
+                             time_str, ip_origin, seqn, ip_dest, value, 
+                             st.num_transactions, st.total_transferred, st.total_balance);
+                    push_log(logbuf);
+                }
+                
+                //reenviar o ACK da ultima requisicao processada
+                reack_last(out, data, origin);
+            }
+
+            //fim da secao critica
+            //libera as travas na ordem inversa da aquisicao
+            unlock_account(client_at(lock1_idx));
+            if (lock_dest) {
+                unlock_account(client_at(lock2_idx));
+            }
+        }
+        return origin_idx;
+    }
+    
+    //lote de transferencias
+    else if (ntohs(pkt.type) == TYPE_BATCH_REQ && data->batch != NULL) {
+        return apply_batch(data);
+    }
+
+    //estatisticas de desempenho: so leitura, responde na hora (fora do journal)
+    else if (ntohs(pkt.type) == TYPE_STATS_REQ) {
+        stats_reply reply;
+        stats_snapshot st;
+        memset(&reply, 0, sizeof(reply));
+        stats_read(&st);
+        pthread_mutex_lock(&client_table_mutex);     //registros concorrentes alteram num_clients
+        int n = num_clients;
+        pthread_mutex_unlock(&client_table_mutex);
+        reply.type = htons(TYPE_STATS_ACK);
+        reply.num_hists = htons(STATS_NUM_HISTS);
+        reply.num_clients = htonl((uint32_t)n);
+        reply.num_transactions = htonl(st.num_transactions);
+        reply.total_transferred = htonl(st.total_transferred);
+        reply.total_balance = htonl(st.total_balance);
+        for (int h = 0; h < STATS_NUM_HISTS; h++) {
+            hist_summarize(h, &reply.hists[h]);
+        }
+        sendto(data->sockfd, &reply, sizeof(reply), 0, (const struct sockaddr *)&data->client_addr, data->len);
+    }
+    
+    //tratamento para outros types
+    else if(ntohs(pkt.type) == TYPE_ERROR_REQ) {} //ignora erros
+    else {}  //ignora tipos de pacotes desconhecidos
+    return -1;
+}
+
+/*
+sequenciador da execucao particionada. cada executor tem uma caixa de entrada por worker,
+um anel com um produtor e um consumidor: o worker escreve o slot e publica 'tail' com
+release; o executor le 'tail' com acquire e devolve os slots publicando 'head' ao fim da
+fase 1. nao ha trava por transacao. o executor 0 fecha a epoca copiando os 'tail' de
+todas as caixas para 'cut' (o numero de sequencia final da epoca em cada caixa); a
+barreira publica os cortes e cada executor aplica as suas caixas em ordem de worker.
+dadas as entradas de cada epoca, o estado final e deterministico: os creditos entre
+particoes sao aplicados depois de uma barreira, na ordem dos executores de origem.
+as entradas nao sao gravadas (por isso -x recusa o journal): o modo so paraleliza a
+execucao, sem reaplicacao nem replicacao.
+*/
+typedef struct {
+    _Atomic size_t tail __attribute__((aligned(CACHE_LINE)));  //proxima posicao a escrever (worker)
+    _Atomic size_t head __attribute__((aligned(CACHE_LINE)));  //proxima posicao a aplicar (executor)
+    request_data *items;
+} executor_inbox;
+
+typedef struct {
+    int index;
+    pthread_t tid;
+    executor_inbox *inbox;      //uma caixa por worker
+    size_t *cut;                //fim da epoca corrente em cada caixa (escrito pelo executor 0)
+    credit_vec *outbox;         //creditos desta epoca para cada particao
+} executor;
+
+static executor *executors = NULL;
+static int engine_workers = 0;          //numero de caixas de cada executor
+static size_t inbox_cap;                //slots de cada caixa (potencia de 2)
+static __thread int my_worker = -1;     //caixa que o worker escreve em cada executor
+
+//so para dormir/acordar: o caminho comum nao toma trava
+static pthread_mutex_t engine_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t engine_ready = PTHREAD_COND_INITIALIZER;  //ha entrada publicada
+static pthread_cond_t engine_space = PTHREAD_COND_INITIALIZER;  //caixas esvaziadas
+static _Atomic bool engine_idle = false;        //executor 0 dormindo sem entrada
+static _Atomic int engine_blocked = 0;          //workers esperando espaco em uma caixa
+static pthread_barrier_t epoch_start;   //cortes da epoca publicados
+static pthread_barrier_t epoch_credits; //todos terminaram suas entradas: creditos prontos
+
+//acorda o executor 0 se ele estiver dormindo
+static void wake_engine(void) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&engine_idle, memory_order_relaxed)) {
+        pthread_mutex_lock(&engine_mutex);
+        pthread_cond_signal(&engine_ready);
+        pthread_mutex_unlock(&engine_mutex);
+    }
+}
+
+/*
+encaminha uma transacao ao executor dono da conta de origem. a posse do lote ('batch')
+passa ao executor. o worker nunca aplica transacoes: com a origem desconhecida ele so
+responde o erro, sem apply_request (a origem pode ser registrada logo depois, e a conta
+passaria a ter o executor e o worker aplicando nela ao mesmo tempo).
+retorna false se a requisicao nao e transacao e deve ser tratada pelo worker.
+*/
+static bool route_to_executor(request_data *data, reply_batch *out) {
+    uint16_t type = ntohs(data->pkt.type);
+    if (type != TYPE_REQ && !(type == TYPE_BATCH_REQ && data->batch != NULL)) {return false;}
+
+    int origin_idx = find_client(&data->client_addr);
+    if (origin_idx == -1) {
+        if (type == TYPE_REQ) {
+            packet error_pkt;
+            memset(&error_pkt, 0, sizeof(packet));
+            error_pkt.type = htons(TYPE_ERROR_REQ);
+            send_reply(out, data, &error_pkt);
+        }
+        else {
+            reject_batch(data);
+        }
+        return true;
+    }
+
+    executor_inbox *box = &executors[account_partition(origin_idx)].inbox[my_worker];
+    size_t pos = atomic_load_explicit(&box->tail, memory_order_relaxed);
+
+    //caixa cheia: espera o dono terminar a epoca corrente e devolver os slots
+    if (pos - atomic_load_explicit(&box->head, memory_order_acquire) == inbox_cap) {
+        atomic_fetch_add(&engine_blocked, 1);
+        pthread_mutex_lock(&engine_mutex);
+        while (pos - atomic_load(&box->head) == inbox_cap) {
+            pthread_cond_wait(&engine_space, &engine_mutex);
+        }
+        pthread_mutex_unlock(&engine_mutex);
+        atomic_fetch_sub(&engine_blocked, 1);
+    }
+
+    box->items[pos & (inbox_cap - 1)] = *data;
+    atomic_store_explicit(&box->tail, pos + 1, memory_order_release);
+    wake_engine();
+
+    data->batch = NULL;
+    data->recv_ns = 0;      //a latencia e registrada pelo executor
+    return true;
+}
+
+/*
+executor 0: fecha a epoca copiando o 'tail' de cada caixa para o corte do seu executor.
+sem entrada publicada, dorme ate um worker sinalizar (o timeout cobre sinais perdidos).
+*/
+static void engine_next_epoch(void) {
+    while (1) {
+        bool any = false;
+        for (int i = 0; i < num_executors; i++) {
+            for (int w = 0; w < engine_workers; w++) {
+                executor_inbox *box = &executors[i].inbox[w];
+                size_t end = atomic_load_explicit(&box->tail, memory_order_acquire);
+                executors[i].cut[w] = end;
+                if (end != atomic_load_explicit(&box->head, memory_order_relaxed)) {any = true;}
+            }
+        }
+        if (any) {return;}
+
+        pthread_mutex_lock(&engine_mutex);
+        atomic_store(&engine_idle, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        bool published = false;
+        for (int i = 0; i < num_executors && !published; i++) {
+            for (int w = 0; w < engine_workers && !published; w++) {
+                executor_inbox *box = &executors[i].inbox[w];
+                published = atomic_load_explicit(&box->tail, memory_order_relaxed) !=
+                            atomic_load_explicit(&box->head, memory_order_relaxed);
+            }
+        }
+        if (!published) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += LOG_IDLE_WAIT_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000) {ts.tv_sec++; ts.tv_nsec -= 1000000000;}
+            pthread_cond_timedwait(&engine_ready, &engine_mutex, &ts);
+        }
+        atomic_store(&engine_idle, false);
+        pthread_mutex_unlock(&engine_mutex);
+    }
+}
+
+/*
+processa uma requisicao retirada da fila por uma thread do pool.
+as respostas sao acumuladas em 'out' e enviadas pelo worker ao fim do lote.
+com executores (-x), transacoes sao so encaminhadas ao dono da conta (ou recusadas).
+depois de uma transacao, aplica em ordem as requisicoes seguintes da mesma conta
+que ja estavam no buffer de reordenacao.
+*/
+void process_request(request_data* data, reply_batch *out) {
+    if (num_executors > 0 && my_partition < 0 && route_to_executor(data, out)) {return;}
+
+    int origin_idx = apply_request(data, out);
+    request_data next;
+
+    while (origin_idx != -1 && reorder_take(origin_idx, &next)) {
+        origin_idx = apply_request(&next, out);
+    }
+}
+
+/*
+thread do pool de workers.
+retira lotes de ate 'io_batch' requisicoes da fila, processa cada uma e envia
+as respostas do lote de uma vez.
+*/
+//latencia recepcao -> resposta (com journal, ate a resposta entrar no lote do commit)
+static void record_latencies(const request_data *reqs, size_t n) {
+    uint64_t now = mono_ns();
+    for (size_t i = 0; i < n; i++) {
+        uint16_t type = ntohs(reqs[i].pkt.type);
+        int hist = type == TYPE_DESCOBERTA ? STATS_HIST_LAT_DISCOVERY :
+                   type == TYPE_BATCH_REQ ? STATS_HIST_LAT_BATCH :
+                   type == TYPE_REQ ? STATS_HIST_LAT_REQ : -1;
+        if (hist >= 0 && reqs[i].recv_ns != 0) {hist_record(hist, now - reqs[i].recv_ns);}
+    }
+}
+
+static void *worker_thread(void *arg) {
+    my_worker = (int)(intptr_t)arg;     //indice da caixa nos executores
+    request_data reqs[MAX_IO_BATCH];
+    reply_batch out;
+    out.count = 0;
+    out.cap = io_batch;
+
+    if (io_backend == IO_URING) {
+        my_tx = tx_uring_create();     //sem anel proprio, o worker envia com sendmmsg
+    }
+
+    while (1) {
+        size_t n = queue_pop_batch(&req_queue, reqs, io_batch);
+        for (size_t i = 0; i < n; i++) {
+            process_request(&reqs[i], &out);
+            batch_release(reqs[i].batch);
+        }
+        flush_replies(&out);
+        record_latencies(reqs, n);
+    }
+    return NULL;
+}
+
+/*
+thread executora de uma particao. cada epoca tem duas fases separadas por barreiras:
+  1. aplica a entrada da epoca (caixas dos workers 0..n-1, cada uma ate o corte), sem travas (a origem e sempre sua; creditos para
+     outras particoes vao para a caixa de saida) e envia as respostas;
+  2. aplica os creditos recebidos, percorrendo as caixas dos executores 0..n-1 em ordem.
+uma caixa so e escrita pelo seu executor na fase 1 e so e lida pelo dono na fase 2.
+*/
+static void *executor_thread(void *arg) {
+    executor *ex = (executor *)arg;
+    my_partition = ex->index;
+    my_outbox = ex->outbox;
+    reply_batch out;
+    out.count = 0;
+    out.cap = io_batch;
+
+    if (io_backend == IO_URING) {
+        my_tx = tx_uring_create();
+    }
+
+    while (1) {
+        if (ex->index == 0) {
+            engine_next_epoch();
+        }
+        pthread_barrier_wait(&epoch_start);
+
+        for (int w = 0; w < engine_workers; w++) {
+            executor_inbox *box = &ex->inbox[w];
+            size_t head = atomic_load_explicit(&box->head, memory_order_relaxed);
+            for (size_t pos = head; pos != ex->cut[w]; pos++) {
+                process_request(&box->items[pos & (inbox_cap - 1)], &out);
+            }
+        }
+        flush_replies(&out);
+        for (int w = 0; w < engine_workers; w++) {
+            executor_inbox *box = &ex->inbox[w];
+            size_t head = atomic_load_explicit(&box->head, memory_order_relaxed);
+            size_t n = ex->cut[w] - head;
+            size_t first = head & (inbox_cap - 1);
+            size_t run = n < inbox_cap - first ? n : inbox_cap - first;     //ate a volta do anel
+            record_latencies(&box->items[first], run);
+            record_latencies(box->items, n - run);
+            for (size_t pos = head; pos != ex->cut[w]; pos++) {
+                batch_release(box->items[pos & (inbox_cap - 1)].batch);
+            }
+            atomic_store_explicit(&box->head, ex->cut[w], memory_order_release);  //devolve os slots
+        }
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&engine_blocked, memory_order_relaxed) > 0) {
+            pthread_mutex_lock(&engine_mutex);
+            pthread_cond_broadcast(&engine_space);
+            pthread_mutex_unlock(&engine_mutex);
+        }
+
+        pthread_barrier_wait(&epoch_credits);
+
+        for (int src = 0; src < num_executors; src++) {
+            credit_vec *cv = &executors[src].outbox[ex->index];
+            for (size_t i = 0; i < cv->count; i++) {
+                account_credit(client_at(cv->items[i].dest_idx), cv->items[i].value);
+            }
+            cv->count = 0;
+        }
+    }
+    return NULL;
+}
+
+//aloca as particoes e as caixas de entrada e inicia os executores
+static int start_executors(size_t cap, int workers) {
+    engine_workers = workers;
+    inbox_cap = 64;         //cada caixa comporta a parte do worker na fila
+    while (inbox_cap < cap / (size_t)workers) {inbox_cap <<= 1;}
+    executors = calloc((size_t)num_executors, sizeof(executor));
+    if (!executors ||
+            pthread_barrier_init(&epoch_start, NULL, (unsigned)num_executors) != 0 ||
+            pthread_barrier_init(&epoch_credits, NULL, (unsigned)num_executors) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < num_executors; i++) {
+        executors[i].index = i;
+        executors[i].inbox = aligned_alloc(CACHE_LINE, (size_t)workers * sizeof(executor_inbox));
+        executors[i].cut = calloc((size_t)workers, sizeof(size_t));
+        executors[i].outbox = calloc((size_t)num_executors, sizeof(credit_vec));
+        if (!executors[i].inbox || !executors[i].cut || !executors[i].outbox) {
+            return -1;
+        }
+        for (int w = 0; w < workers; w++) {
+            executor_inbox *box = &executors[i].inbox[w];
+            atomic_init(&box->tail, 0);
+            atomic_init(&box->head, 0);
+            box->items = calloc(inbox_cap, sizeof(request_data));
+            if (!box->items) {return -1;}
+        }
+    }
+    for (int i = 0; i < num_executors; i++) {
+        if (pthread_create(&executors[i].tid, NULL, executor_thread, &executors[i]) != 0) {
+            return -1;
+        }
+        pthread_detach(executors[i].tid);
+    }
+    return 0;
+}
+
+//socket de recepcao e seu laco (um por nucleo no modo SO_REUSEPORT)
+typedef struct {
+    int sockfd;
+    int index;          //o shard 0 e o unico que responde descobertas por broadcast
+    pthread_t tid;
+    batch_pool batches; //buffers dos lotes recebidos por este shard
+} rx_shard;
+
+static int num_shards = 1;
+static bool pin_shards = false;     //fixa cada laco de recepcao em um nucleo
+
+#define PKTINFO_CTRL_LEN CMSG_SPACE(sizeof(struct in_pktinfo))
+
+/*
+broadcasts sao entregues a todos os sockets do grupo SO_REUSEPORT.
+para nao registrar/responder a mesma descoberta varias vezes, somente o shard 0 trata
+datagramas cujo endereco de destino (IP_PKTINFO) nao e o endereco local.
+*/
+static bool skip_broadcast_copy(const rx_shard *shard, struct msghdr *hdr) {
+    if (shard->index == 0) {return false;}
+
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(hdr); c != NULL; c = CMSG_NXTHDR(hdr, c)) {
+        if (c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_PKTINFO) {
+            struct in_pktinfo info;
+            memcpy(&info, CMSG_DATA(c), sizeof(info));
+            return info.ipi_addr.s_addr != info.ipi_spec_dst.s_addr;
+        }
+    }
+    return false;
+}
+
+//laco de recepcao simples: um datagrama por chamada de recvmsg
+static void receive_loop(rx_shard *shard) {
+    char ctrl[PKTINFO_CTRL_LEN];
+    char tail[BATCH_TAIL_SIZE];     //restante de um datagrama de lote
+
+    while(1) {
+        request_data data;
+        struct iovec iov[2] = {
+            { .iov_base = &data.pkt, .iov_len = sizeof(packet) },
+            { .iov_base = tail, .iov_len = sizeof(tail) },
+        };
+        struct msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_name = &data.client_addr;
+        hdr.msg_namelen = sizeof(data.client_addr);
+        hdr.msg_iov = iov;
+        hdr.msg_iovlen = 2;
+        hdr.msg_control = ctrl;
+        hdr.msg_controllen = sizeof(ctrl);
+
+        //aguarda a chegada de um pacote UDP
+        ssize_t n = recvmsg(shard->sockfd, &hdr, 0);
+
+        if (n > 0 && !skip_broadcast_copy(shard, &hdr) && attach_batch(&shard->batches, &data, tail, (size_t)n)) {  //pacote recebido
+            data.recv_ns = mono_ns();
+            data.len = hdr.msg_namelen;
+            data.sockfd = shard->sockfd;    //passa o socket para o worker poder responder
+            queue_push(&req_queue, &data);
+        }
     }
+}
 
-    else {
-        log_head = n;           //fila vazia
+//buffers de uma rajada de recvmmsg
+typedef struct {
+    request_data reqs[MAX_IO_BATCH];
+    struct mmsghdr msgs[MAX_IO_BATCH];
+    struct iovec iovs[MAX_IO_BATCH][2];
+    char ctrls[MAX_IO_BATCH][PKTINFO_CTRL_LEN];
+    char tails[MAX_IO_BATCH][BATCH_TAIL_SIZE];     //restos de datagramas de lote
+} rx_burst;
+
+/*
+recebe ate 'io_batch' datagramas com um recvmmsg e enfileira os validos.
+retorna o numero de datagramas lidos (<= 0 em erro, p.ex. EAGAIN sem bloqueio).
+*/
+static int receive_burst(rx_shard *shard, rx_burst *b, int flags) {
+    for (size_t i = 0; i < io_batch; i++) {
+        b->iovs[i][0].iov_base = &b->reqs[i].pkt;
+        b->iovs[i][0].iov_len = sizeof(packet);
+        b->iovs[i][1].iov_base = b->tails[i];
+        b->iovs[i][1].iov_len = BATCH_TAIL_SIZE;
+        memset(&b->msgs[i], 0, sizeof(struct mmsghdr));
+        b->msgs[i].msg_hdr.msg_name = &b->reqs[i].client_addr;
+        b->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        b->msgs[i].msg_hdr.msg_iov = b->iovs[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 2;
+        b->msgs[i].msg_hdr.msg_control = b->ctrls[i];
+        b->msgs[i].msg_hdr.msg_controllen = PKTINFO_CTRL_LEN;
     }
 
-    log_tail = n;
+    int n = recvmmsg(shard->sockfd, b->msgs, (unsigned int)io_batch, flags, NULL);
+    if (n <= 0) {return n;}
 
-    //sinaliza a atualização
-    pthread_cond_signal(&update_cond);
-    pthread_mutex_unlock(&log_mutex);
+    //descarta datagramas vazios e completa os campos das requisicoes
+    uint64_t recv_ns = mono_ns();
+    size_t valid = 0;
+    for (int i = 0; i < n; i++) {
+        if (b->msgs[i].msg_len == 0 || skip_broadcast_copy(shard, &b->msgs[i].msg_hdr)) {continue;}
+        if (!attach_batch(&shard->batches, &b->reqs[i], b->tails[i], b->msgs[i].msg_len)) {continue;}
+        b->reqs[valid] = b->reqs[i];
+        b->reqs[valid].len = b->msgs[i].msg_hdr.msg_namelen;
+        b->reqs[valid].sockfd = shard->sockfd;
+        b->reqs[valid].recv_ns = recv_ns;
+        valid++;
+    }
+    queue_push_batch(&req_queue, b->reqs, valid);
+    return n;
 }
 
 /*
-thread para imprimir logs.
-fica a maior parte do tempo bloqueada, aguardando a variável de condição 'update_cond'.
-quando ativada, imprime todos os logs na fila e volta a aguardar.
+laco de recepcao em lote: cada recvmmsg espera pelo menos um datagrama e
+retorna ate 'io_batch' dos que ja estiverem no buffer do socket.
 */
-static void *interface_thread(void *arg) {
-    (void)arg;                      //evitar "unused parameter"
-    pthread_mutex_lock(&log_mutex); //trava inicial
-    while (1) {
-        while (log_head == NULL) {
-            //espera por novas atualizações
-            pthread_cond_wait(&update_cond, &log_mutex);
-        }
+static void receive_loop_batched(rx_shard *shard) {
+    rx_burst b;
 
-        //imprime todos os logs atualmente na fila 
-        while (log_head) {
-            log_node_t *n = log_head;
-            log_head = n->next;
-            if (log_head == NULL) log_tail = NULL;
-            
-            printf("%s\n", n->text);
-            fflush(stdout);
-            free(n);
-        }
+    while (1) {
+        receive_burst(shard, &b, MSG_WAITFORONE);
     }
-    pthread_mutex_unlock(&log_mutex);
-    return NULL;
 }
 
-//encontra o indice de um cliente na tabela pelo seu endereco
-int find_client(struct sockaddr_in* cliaddr) {
-    for (int i = 0; i < num_clients; i++) {
-        if (client_table[i].client_ip.s_addr == cliaddr->sin_addr.s_addr) {
-            return i;
-        }
+/*
+laco de recepcao orientado a eventos: a thread so dorme em epoll_wait; a cada evento
+esvazia o buffer do socket em rajadas de recvmmsg com MSG_DONTWAIT ate EAGAIN. o socket
+continua bloqueante (so a recepcao e nao bloqueante, por chamada), pois os workers
+respondem por ele e um envio com EAGAIN perderia o ACK.
+*/
+static void receive_loop_epoll(rx_shard *shard) {
+    rx_burst b;
+
+    int epfd = epoll_create1(0);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = shard->sockfd };
+    if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, shard->sockfd, &ev) < 0) {
+        perror("falha ao configurar epoll");
+        exit(EXIT_FAILURE);
     }
-    return -1;
-}
 
-//encontra o destino da transferencia
-int find_client_ip(struct in_addr ip_addr) {
-    for (int i = 0; i < num_clients ; i++) {
-        if (client_table[i].client_ip.s_addr == ip_addr.s_addr) {
-            return i;
-        }
+    while (1) {
+        struct epoll_event got;
+        if (epoll_wait(epfd, &got, 1, -1) <= 0) {continue;}
+        while (receive_burst(shard, &b, MSG_DONTWAIT) > 0) {}
     }
-    return -1;
 }
 
 /*
-registra um novo cliente
-adiciona o cliente em 'client_table'. inicializa seu saldo. sera seu 'seqn'. inicializa seu mutex. 
-atualiza estatisticas globais.
+laco de recepcao com io_uring: RX_INFLIGHT recvmsg ficam sempre em voo, cada um com
+seu slot pre-alocado (requisicao, resto de lote, controle e msghdr). o socket e
+registrado como arquivo fixo, o que evita a busca do descritor a cada operacao.
+a cada volta, um unico io_uring_enter resubmete os slots concluidos e espera novas
+conclusoes, que sao enfileiradas juntas para os workers.
 */
-int register_new_client(struct sockaddr_in* cliaddr) {
-    if (num_clients < MAX_CLIENTS) {
-        int new_client_id = num_clients;
-        client_table[new_client_id].client_ip = cliaddr->sin_addr;
-        client_table[new_client_id].last_req = 0;
-        client_table[new_client_id].balance = INITIAL_BALANCE;
-
-        //mutex especifico do cliente
-        if (pthread_mutex_init(&client_table[new_client_id].client_lock, NULL) != 0) {
-            return -1; 
-        }
-
-        num_clients++;
-
-        //atualiza estatisticas globais
-        uint32_t current_total_balance;
-        pthread_mutex_lock(&stats_mutex);
-        total_balance += INITIAL_BALANCE;
-        current_total_balance = total_balance;
-        uint32_t local_num_trans = num_transactions;
-        uint32_t local_total_trans = total_transferred;
-        pthread_mutex_unlock(&stats_mutex);
-        
-        //loga o registro do novo cliente
-        char time_str[100];
-        char logbuf[LOG_MSG_LEN];
-        get_current_time(time_str, sizeof(time_str));
-        snprintf(logbuf, sizeof(logbuf),
-                 "%s client %s id req 0 dest 0 value 0 num_transactions %u total_transferred %u total_balance %u",
-                 time_str,
-                 inet_ntoa(cliaddr->sin_addr),
-                 local_num_trans,
-                 local_total_trans,
-                 current_total_balance);
-        push_log(logbuf);        
-        return new_client_id;
-    }
+#define RX_INFLIGHT 128
 
-    return -1;
-}
+typedef struct {
+    request_data data;
+    char tail[BATCH_TAIL_SIZE];
+    char ctrl[PKTINFO_CTRL_LEN];
+    struct iovec iov[2];
+    struct msghdr hdr;
+} rx_slot;
 
-// obtem a data/hora formatada
-void get_current_time(char* buffer, size_t buffer_size) {
-    time_t now = time(0);
-    struct tm *t = localtime(&now);
-    strftime(buffer, buffer_size, "%Y-%m-%d %H:%M:%S", t);
+static void rx_slot_arm(uring *r, rx_slot *slot, uint64_t idx) {
+    slot->iov[0].iov_base = &slot->data.pkt;
+    slot->iov[0].iov_len = sizeof(packet);
+    slot->iov[1].iov_base = slot->tail;
+    slot->iov[1].iov_len = BATCH_TAIL_SIZE;
+    memset(&slot->hdr, 0, sizeof(slot->hdr));
+    slot->hdr.msg_name = &slot->data.client_addr;
+    slot->hdr.msg_namelen = sizeof(struct sockaddr_in);
+    slot->hdr.msg_iov = slot->iov;
+    slot->hdr.msg_iovlen = 2;
+    slot->hdr.msg_control = slot->ctrl;
+    slot->hdr.msg_controllen = PKTINFO_CTRL_LEN;
+
+    struct io_uring_sqe *sqe = uring_get_sqe(r);   //um slot por SQE: a fila nunca enche
+    uring_prep_msg(sqe, IORING_OP_RECVMSG, 0, &slot->hdr, idx);
+    sqe->flags = IOSQE_FIXED_FILE;      //indice 0 da tabela de arquivos registrados
 }
 
+static void receive_loop_uring(rx_shard *shard) {
+    uring ring;
+    rx_slot *slots = calloc(RX_INFLIGHT, sizeof(rx_slot));
+    request_data reqs[MAX_IO_BATCH];
 
+    if (!slots || uring_init(&ring, RX_INFLIGHT) != 0 ||
+            syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_FILES, &shard->sockfd, 1) < 0) {
+        perror("falha ao inicializar io_uring");
+        exit(EXIT_FAILURE);
+    }
+    for (uint64_t i = 0; i < RX_INFLIGHT; i++) {
+        rx_slot_arm(&ring, &slots[i], i);
+    }
 
-//estrutura para passar dados para a thread
-typedef struct {
-    packet pkt;
-    struct sockaddr_in client_addr;
-    socklen_t len;
-    int sockfd;
-} request_data;
+    while (1) {
+        int ret = uring_submit(&ring, 1);
+        if (ret < 0) {
+            uring_check_submit(ret);
+            continue;
+        }
 
-/*
-função executada por nova thread.
-ela executa em uma nova thread para cada pacote recebido. lida com a descoberta de clientes.
-lida também com a descoberta de clientes e com as requisicoes de transação/consulta.
-*/
-void* process_request(void* arg) {
+        uint64_t recv_ns = mono_ns();
+        size_t valid = 0;
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+            rx_slot *slot = &slots[cqe->user_data];
+            int n = cqe->res;
+            uring_cqe_seen(&ring);
 
-    //recupera os dados da requisicao
-    request_data* data = (request_data*)arg;
-    packet pkt = data->pkt;
-    struct sockaddr_in client_addr = data->client_addr;
-    int sockfd = data->sockfd;
-    socklen_t len = data->len;
-    
-    //buffers para logs
-    char logbuf[LOG_MSG_LEN];
-    char time_str[100];
-    char ip_origin[INET_ADDRSTRLEN];
-    char ip_dest[INET_ADDRSTRLEN];
+            if (n > 0 && !skip_broadcast_copy(shard, &slot->hdr) &&
+                    attach_batch(&shard->batches, &slot->data, slot->tail, (size_t)n)) {
+                reqs[valid] = slot->data;
+                reqs[valid].len = slot->hdr.msg_namelen;
+                reqs[valid].sockfd = shard->sockfd;     //respostas usam o descritor normal
+                reqs[valid].recv_ns = recv_ns;
+                valid++;
+            }
+            rx_slot_arm(&ring, slot, cqe->user_data);
 
-    //lógica de descoberta
-    if (ntohs(pkt.type) == TYPE_DESCOBERTA) {
-        pthread_mutex_lock(&client_table_mutex);        //trava tabela de clientes para verificar e registrar
-        int client_idx = find_client(&client_addr);
-        
-        if (client_idx == -1) {
-            register_new_client(&client_addr);  //registro de cliente novo
+            if (valid == MAX_IO_BATCH) {
+                queue_push_batch(&req_queue, reqs, valid);
+                valid = 0;
+            }
         }
-
-        //responde com ACK de descoberta
-        pthread_mutex_unlock(&client_table_mutex);
-        packet ack_pkt;
-        memset(&ack_pkt, 0, sizeof(packet));
-        ack_pkt.type = htons(TYPE_ACK_DESCOBERTA);
-        sendto(sockfd, &ack_pkt, sizeof(packet), 0, (const struct sockaddr *)&client_addr, len);                
+        queue_push_batch(&req_queue, reqs, valid);
     }
-    
-    //lógica de requisição
-    else if (ntohs(pkt.type) == TYPE_REQ) {
-        uint32_t seqn = ntohl(pkt.seqn);
-        uint32_t value = ntohl(pkt.value);
+}
 
-        //busca IDs dos clientes de origem e destino
-        pthread_mutex_lock(&client_table_mutex);
-        int origin_idx = find_client(&client_addr);
-        int dest_idx = find_client_ip(pkt.dest_addr);
-        pthread_mutex_unlock(&client_table_mutex);
+//corpo da thread de recepcao de um shard
+static void *receive_thread(void *arg) {
+    rx_shard *shard = (rx_shard *)arg;
 
-        uint32_t new_balance = 0;
-        
-        bool send_ack = true; //controlar envio de ack e error
-        
-        if (origin_idx == -1) { //cliente de origem ou destino desconhecido
-            packet error_pkt;
-            memset(&error_pkt, 0, sizeof(packet));
-            error_pkt.type = htons(TYPE_ERROR_REQ);
-            sendto(sockfd, &error_pkt, sizeof(packet), 0, (const struct sockaddr *)&client_addr, len);
-            
-        }
-        
-        else if (dest_idx == -1) {    //cliente de destino não existe
-            packet error_pkt;
-            memset(&error_pkt, 0, sizeof(packet));
-            error_pkt.type = htons(TYPE_ERROR_REQ);
-            sendto(sockfd, &error_pkt, sizeof(packet), 0, (const struct sockaddr *)&client_addr, len);
-        } 
-        
-        else {
-            //lógica de travamento
-            bool self_transfer = (origin_idx == dest_idx);
-            int lock1_idx = origin_idx;
-            int lock2_idx = dest_idx;
-            
-            //garante que o mutex com indice menor seja travado primeiro (evita deadlock)
-            if (!self_transfer) {
-                lock1_idx = (origin_idx < dest_idx) ? origin_idx : dest_idx;
-                lock2_idx = (origin_idx > dest_idx) ? origin_idx : dest_idx;
-            }
+    if (pin_shards) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(shard->index % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    batch_pool_init(&shard->batches);   //depois da afinidade: memoria local ao nucleo
 
-            //bloqueia mutex clientes
-            pthread_mutex_lock(&client_table[lock1_idx].client_lock);
-            if (!self_transfer) {
-                pthread_mutex_lock(&client_table[lock2_idx].client_lock);
-            }
-            
-            //seção critica clientes
-            uint32_t expected_seqn = client_table[origin_idx].last_req + 1;
-            uint32_t current_balance = (uint32_t)client_table[origin_idx].balance;
-            new_balance = current_balance;
-            uint32_t last_processed_seqn = client_table[origin_idx].last_req;
-
-            //Pacote novo e esperado
-            if (seqn == expected_seqn) {
-                if (value == 0) {
-                    // 1. a consulta de saldo é uma requisição válida, então logamos
-                    //(não altera num_transactions ou total_transferred)
-                    uint32_t local_num_trans, local_total_trans, local_total_bal;
-                    pthread_mutex_lock(&stats_mutex);
-                    local_num_trans = num_transactions;
-                    local_total_trans = total_transferred;
-                    local_total_bal = total_balance;
-                    pthread_mutex_unlock(&stats_mutex);
+    if (io_backend == IO_URING) {
+        receive_loop_uring(shard);
+    }
+    else if (io_backend == IO_EPOLL) {
+        receive_loop_epoll(shard);
+    }
+    else if (io_batch > 1) {
+        receive_loop_batched(shard);
+    }
+    else {
+        receive_loop(shard);
+    }
+    return NULL;
+}
 
-                    get_current_time(time_str, sizeof(time_str));
-                    strcpy(ip_origin, inet_ntoa(client_addr.sin_addr));
-                    strcpy(ip_dest, inet_ntoa(pkt.dest_addr));
-                    
-                    snprintf(logbuf, sizeof(logbuf),
-                             "%s client %s id req %u dest %s value 0 num_transactions %u total_transferred %u total_balance %u",
-                             time_str, ip_origin, seqn, ip_dest,
-                             local_num_trans, local_total_trans, local_total_bal);
-                    push_log(logbuf);
-                    
-                    // 2. envia ACK com saldo ATUAL e seqn ATUAL
-                    packet ack_pkt;
-                    memset(&ack_pkt, 0, sizeof(packet));
-                    ack_pkt.type = htons(TYPE_ACK_REQ);
-                    ack_pkt.balance = htonl(current_balance); 
-                    ack_pkt.seqn = htonl(seqn);
-                    sendto(sockfd, &ack_pkt, sizeof(packet), 0, (const struct sockaddr *)&client_addr, len);
-                    
-                    // 3. atualiza o last_req 
-                    // sem isso o, o cliente vai ficar reenviando a consulta.
-                    client_table[origin_idx].last_req = seqn;
-                    
-                    // 4. libera travas e encerra a thread
-                    pthread_mutex_unlock(&client_table[lock1_idx].client_lock);
-                    if (!self_transfer) {
-                        pthread_mutex_unlock(&client_table[lock2_idx].client_lock);
-                    }
-                    free(arg); 
-                    return NULL; //termina a thread
-                }
-                
-                if (self_transfer) {} //auto-transferencia nao faz nada
-                
-                //verifica se tem saldo suficiente
-                else if (current_balance >= value) {
-                    //executa a transferencia
-                    client_table[origin_idx].balance -= (int32_t)value;
-                    client_table[dest_idx].balance += (int32_t)value;
-                    new_balance = (uint32_t)client_table[origin_idx].balance;
+/*
+cria e vincula um socket UDP na porta. com 'reuseport' varios sockets podem
+compartilhar a porta e o kernel distribui os datagramas entre eles.
+*/
+static int open_server_socket(int port, bool reuseport) {
+    int sockfd;
+    struct sockaddr_in server_addr;
 
-                    //atualiza estatisticas globais (transferencia bem-sucedida)
-                    uint32_t local_num_trans, local_total_trans, local_total_bal;
-                    pthread_mutex_lock(&stats_mutex);
-                    num_transactions++;
-                    total_transferred += value;
-                    local_num_trans = num_transactions;
-                    local_total_trans = total_transferred;
-                    local_total_bal = total_balance;
-                    pthread_mutex_unlock(&stats_mutex);                 
-                }
-                else {} //saldo insuficiente. 'new_balance' continua 'current_balance'
-                
-                //atualiza o ultimo seqn processado para este cliente
-                client_table[origin_idx].last_req = seqn;
-                last_processed_seqn = seqn;
-
-                //pega estatisticas para o log (mesmo se a transacao falhou por saldo)
-                uint32_t local_num_trans, local_total_trans, local_total_bal;
-                pthread_mutex_lock(&stats_mutex);
-                local_num_trans = num_transactions;
-                local_total_trans = total_transferred;
-                local_total_bal = total_balance;
-                pthread_mutex_unlock(&stats_mutex);
-                
-                //loga a tentativa de transferencia
-                get_current_time(time_str, sizeof(time_str));
-                strcpy(ip_origin, inet_ntoa(client_addr.sin_addr));
-                strcpy(ip_dest, inet_ntoa(pkt.dest_addr));
-                
-                snprintf(logbuf, sizeof(logbuf),
-                         "%s client %s id req %u dest %s value %u num_transactions %u total_transferred %u total_balance %u",
-                         time_str, ip_origin, seqn, ip_dest, value, 
-                         local_num_trans, local_total_trans, local_total_bal);
-                push_log(logbuf);
-
-                //envia ACK para a requisição processada (com sucesso ou falha)
-                packet ack_pkt;
-                memset(&ack_pkt, 0, sizeof(packet));
-                ack_pkt.type = htons(TYPE_ACK_REQ);
-                ack_pkt.balance = htonl(new_balance);   // o novo saldo (ou o antigo se falhou)
-                ack_pkt.seqn = htonl(seqn);             // confirma o seqn da requisicao
-                sendto(sockfd, &ack_pkt, sizeof(packet), 0, (const struct sockaddr *)&client_addr, len);
-            }
+    // configura o socket udp
+    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("falha em criar o socket");
+        return -1;
+    }
 
-            //pacote duplicado (seqn <= last_req) ou pacote fora de ordem (seqn > expected_seqn)
-            else {
+    int on = 1;
+    if (reuseport && (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0 ||
+            setsockopt(sockfd, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on)) < 0)) {
+        perror("falha ao configurar SO_REUSEPORT");
+        close(sockfd);
+        return -1;
+    }
 
-                //se for duplicata, loga como "DUP!!""
-                if (seqn <= client_table[origin_idx].last_req) {
-                    
-                    //log de duplicata 
-                    char time_str[100];
-                    char ip_origin[INET_ADDRSTRLEN];
-                    char ip_dest[INET_ADDRSTRLEN];
-                    
-                    get_current_time(time_str, sizeof(time_str));
-                    strcpy(ip_origin, inet_ntoa(client_addr.sin_addr));
-                    strcpy(ip_dest, inet_ntoa(pkt.dest_addr));
-                    uint32_t local_num_trans, local_total_trans, local_total_bal;
-                    pthread_mutex_lock(&stats_mutex);
-                    local_num_trans = num_transactions;
-                    local_total_trans = total_transferred;
-                    local_total_bal = total_balance;
-                    pthread_mutex_unlock(&stats_mutex);
-                    snprintf(logbuf, sizeof(logbuf),
-                           "%s client %s DUP!! id req %u dest %s value %u num_transactions %u total_transferred %u total_balance %u",
-                           time_str, ip_origin, seqn, ip_dest, value, 
-                           local_num_trans, local_total_trans, local_total_bal);
-                    push_log(logbuf);
-                } 
-                
-                //se for fora de orgem (pacote do futuro), loga normalmente
-                else {
-                    get_current_time(time_str, sizeof(time_str));
-                    strcpy(ip_origin, inet_ntoa(client_addr.sin_addr));
-                    strcpy(ip_dest, inet_ntoa(pkt.dest_addr));
-                    uint32_t local_num_trans, local_total_trans, local_total_bal;
-                    pthread_mutex_lock(&stats_mutex);
-                    local_num_trans = num_transactions;
-                    local_total_trans = total_transferred;
-                    local_total_bal = total_balance;
-                    pthread_mutex_unlock(&stats_mutex);
-                    
-                    snprintf(logbuf, sizeof(logbuf),
-                             "%s client %s id req %u dest %s value %u num_transactions %u total_transferred %u total_balance %u",
-                             time_str, ip_origin, seqn, ip_dest, value, 
-                             local_num_trans, local_total_trans, local_total_bal);
-                    push_log(logbuf);
-                }
-                
-                //reenviar o ACK da ultima requisicao processada
-                packet ack_pkt;
-                memset(&ack_pkt, 0, sizeof(packet));
-                ack_pkt.type = htons(TYPE_ACK_REQ);
-                ack_pkt.balance = htonl(current_balance);                   //saldo atual (resultado do ultimo ACK)
-                ack_pkt.seqn = htonl(client_table[origin_idx].last_req);    //seqn do ultimo ACK
-                sendto(sockfd, &ack_pkt, sizeof(packet), 0, (const struct sockaddr *)&client_addr, len);
-            }
+    //zera a estrutura de endereço do servidor
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;   //escuta em todas as interfaces de rede
+    server_addr.sin_port = htons(port);         //converte a porta pra "network byte order"
 
-            //fim da secao critica
-            //libera as travas na ordem inversa da aquisicao
-            pthread_mutex_unlock(&client_table[lock1_idx].client_lock);
-            if (!self_transfer) {
-                pthread_mutex_unlock(&client_table[lock2_idx].client_lock);
-            }
-        }
+    //vincula o scoket a porta e endereco especificados
+    if (bind(sockfd, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("falha no bind");
+        close(sockfd);
+        return -1;
     }
-    
-    //tratamento para outros types
-    else if(ntohs(pkt.type) == TYPE_ERROR_REQ) {} //ignora erros
-    else {}  //ignora tipos de pacotes desconhecidos
-    free(arg);
-    return NULL;
+    return sockfd;
 }
 
 
 
+static void usage(void) {
+    fprintf(stderr, "Uso: ./servidor <porta> [-w workers] [-q capacidade_fila] [-b lote_io] [-s sockets] [-a]\n"
+                    "                 [-l block|drop|spill] [-m] [-j journal] [-g janela_us]\n"
+                    "                 [-S snapshot -P periodo_s] [-e uring|epoll] [-D] [-x executores]\n");
+}
+
 int main(int argc, char *argv[]) {
     
-    if (argc != 2) {
-        fprintf(stderr, "Uso: ./servidor <porta>\n");
+    int num_workers = DEFAULT_WORKERS;
+    size_t queue_cap = DEFAULT_QUEUE_CAP;
+
+    //opcoes: -w <workers> -q <capacidade da fila> -b <datagramas por syscall>
+    //        -s <sockets SO_REUSEPORT, 0 = um por nucleo> -a (afinidade de cpu)
+    //        -l <block|drop|spill> (politica do log com o anel cheio) -m (timestamps com ms)
+    //        -j <arquivo de journal> -g <janela de commit em grupo, us>
+    //        -S <arquivo de snapshot> -P <periodo do snapshot, s> (exigem -j)
+    //        -e <uring|epoll> (recepcao orientada a eventos; lote de io padrao MAX_IO_BATCH)
+    //        -D (creditos diferidos para contas quentes; incompativel com -j)
+    //        -x <executores> (contas particionadas entre executores sem travas; so execucao:
+    //           as entradas das epocas nao vao ao journal, por isso incompativel com -j e -D)
+    const char *journal_path = NULL;
+    bool io_batch_set = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:q:b:s:al:mj:g:S:P:e:Dx:")) != -1) {
+        switch (opt) {
+            case 'w': num_workers = atoi(optarg); break;
+            case 'q': queue_cap = (size_t)atol(optarg); break;
+            case 'b': io_batch = (size_t)atol(optarg); io_batch_set = true; break;
+            case 's': num_shards = atoi(optarg); break;
+            case 'a': pin_shards = true; break;
+            case 'l':
+                if (strcmp(optarg, "block") == 0) {log_policy = LOG_FULL_BLOCK;}
+                else if (strcmp(optarg, "drop") == 0) {log_policy = LOG_FULL_DROP;}
+                else if (strcmp(optarg, "spill") == 0) {log_policy = LOG_FULL_SPILL;}
+                else {usage(); return 1;}
+                break;
+            case 'm': time_millis = true; break;
+            case 'j': journal_path = optarg; break;
+            case 'g': journal_window_us = atol(optarg); break;
+            case 'S': snapshot_path = optarg; break;
+            case 'P': snapshot_period = atoi(optarg); break;
+            case 'D': deferred_credits = true; break;
+            case 'x': num_executors = atoi(optarg); break;
+            case 'e':
+                if (strcmp(optarg, "uring") == 0) {io_backend = IO_URING;}
+                else if (strcmp(optarg, "epoll") == 0) {io_backend = IO_EPOLL;}
+                else {usage(); return 1;}
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1 || num_workers <= 0 || queue_cap == 0 ||
+            io_batch == 0 || io_batch > MAX_IO_BATCH || num_shards < 0 ||
+            (snapshot_path && !journal_path) || snapshot_period <= 0 ||
+            (deferred_credits && journal_path) || num_executors < 0 ||
+            //-x nao grava as entradas das epocas: a reaplicacao do journal nao reproduziria a execucao
+            (num_executors > 0 && (journal_path || deferred_credits))) {
+        usage();
         return 1;
     }
 
-    int port = atoi(argv[1]);
-    int sockfd;
-    struct sockaddr_in server_addr;
+    if (io_backend != IO_THREADS && !io_batch_set) {
+        io_batch = MAX_IO_BATCH;
+    }
+
+    //kernels sem io_uring (ou com ele bloqueado) usam o backend epoll
+    if (io_backend == IO_URING) {
+        uring probe;
+        if (uring_init(&probe, 1) != 0) {
+            perror("io_uring indisponivel, usando epoll");
+            io_backend = IO_EPOLL;
+        }
+        else {
+            close(probe.fd);
+        }
+    }
+
+    int port = atoi(argv[optind]);
+    if (num_shards == 0) {
+        num_shards = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
     
     //inicializa os mutexes e variaveis de condicao globais
     if (pthread_mutex_init(&client_table_mutex, NULL) != 0 || 
-            pthread_mutex_init(&stats_mutex, NULL) != 0 ||
-            pthread_mutex_init(&log_mutex, NULL) != 0 ||
-            pthread_cond_init(&update_cond, NULL) != 0) {
+            log_init() != 0) {
             perror("falha ao inicializar mutexes/cond globais.\n");
             exit(EXIT_FAILURE);
     }
 
-    // configura o socket udp
-    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-        perror("falha em criar o socket");
+    //fila de requisicoes com slots pre-alocados
+    if (queue_init(&req_queue, queue_cap) != 0) {
+        perror("falha ao inicializar fila de requisicoes");
         exit(EXIT_FAILURE);
     }
-    
-    //zera a estrutura de endereço do servidor
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;   //escuta em todas as interfaces de rede
-    server_addr.sin_port = htons(port);         //converte a porta pra "network byte order"
 
+    //journal: carrega o snapshot, reaplica a cauda do historico e inicia o commit em grupo
+    if (journal_path) {
+        uint64_t first_lsn = 1, stats_lsn = 0;
+        if ((snapshot_path && snapshot_load(&first_lsn, &stats_lsn) != 0) ||
+                journal_open(journal_path, first_lsn, stats_lsn) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < num_clients; i++) {
+            atomic_store(&client_at(i)->last_ack, account_state(client_at(i)));  //contas restauradas
+        }
+        pthread_t journal_tid;
+        if (pthread_create(&journal_tid, NULL, journal_thread, NULL) != 0) {
+            perror("falha ao criar thread do journal");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(journal_tid);
 
-    //vincula o scoket a porta e endereco especificados
-    if (bind(sockfd, (const struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("falha no bind");
+        if (snapshot_path) {
+            pthread_t snapshot_tid;
+            if (pthread_create(&snapshot_tid, NULL, snapshot_thread, NULL) != 0) {
+                perror("falha ao criar thread de snapshot");
+                exit(EXIT_FAILURE);
+            }
+            pthread_detach(snapshot_tid);
+        }
+    }
+
+    //um socket por shard; com mais de um, todos compartilham a porta via SO_REUSEPORT
+    rx_shard *shards = calloc((size_t)num_shards, sizeof(rx_shard));
+    if (!shards) {
+        perror("falha ao alocar shards");
         exit(EXIT_FAILURE);
     }
-    
+    for (int i = 0; i < num_shards; i++) {
+        shards[i].index = i;
+        shards[i].sockfd = open_server_socket(port, num_shards > 1);
+        if (shards[i].sockfd < 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
     //inicialização da thread de interface/log
     pthread_t int_tid;
     if (pthread_create(&int_tid, NULL, interface_thread, NULL) != 0) {
         perror("falha ao criar thread de interface");
-        close(sockfd);
         exit(EXIT_FAILURE);
     }
     pthread_detach(int_tid);    //nao há join nela, ela roda sempre
 
+    //executores das particoes de contas (antes dos workers, que encaminham a eles)
+    if (num_executors > 0 && start_executors(queue_cap, num_workers) != 0) {
+        perror("falha ao iniciar executores");
+        exit(EXIT_FAILURE);
+    }
+
+    //inicialização do pool de workers
+    for (int i = 0; i < num_workers; i++) {
+        pthread_t worker_tid;
+        if (pthread_create(&worker_tid, NULL, worker_thread, (void *)(intptr_t)i) != 0) {
+            perror("falha ao criar thread worker");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(worker_tid);
+    }
+
     //log inicial
     char time_str[100];
     get_current_time(time_str, sizeof(time_str));
-    pthread_mutex_lock(&stats_mutex);
+    stats_snapshot st;
+    stats_read(&st);
 
     //imprime o log inicial diretamente, pois a thread de log já pode estar rodando
     printf("%s num_transactions %u total_transferred %u total_balance %u\n", 
-        time_str, num_transactions, total_transferred, total_balance);
-    pthread_mutex_unlock(&stats_mutex);
+        time_str, st.num_transactions, st.total_transferred, st.total_balance);
+    fflush(stdout);     //a interface escreve direto no descritor, sem passar pelo stdio
     
     
-    while(1) {
-        struct sockaddr_in client_addr_temp;    //endereço do cliente(temporario)
-        packet pkt_temp;                        //pacote recebido (temporario)
-        
-        socklen_t len = sizeof(client_addr_temp);
-        
-        //aguarda a chegada de um pacote UDP
-        int n = recvfrom(sockfd, &pkt_temp, sizeof(packet), 0, (struct sockaddr *)&client_addr_temp, &len);
-        
-        if (n>0) {  //pacote recebido
-
-
-            // aloca memoria no heap para os dados da requisicao
-            request_data* data = (request_data*)malloc(sizeof(request_data));
-            
-            if (data == NULL) {
-                perror("falha ao alocar memória para thread.\n");
-                continue;
-            }
-            
-            //copia dados do pacote e do cliente para a struct alocada no heap
-            data->pkt = pkt_temp;
-            data->client_addr = client_addr_temp;
-            data->len = len;
-            data->sockfd = sockfd;      //passa o socket para a thread poder responder
-            
-            //thread para processar requisicao
-            pthread_t thread_id;
-            if (pthread_create(&thread_id, NULL, process_request, (void*)data) != 0) {
-                perror("falha ao criar thread");
-                free(data); //libera memória se a thread não foi criada
-            }
-            
-             
-            pthread_detach(thread_id);
+    //um laco de recepcao por socket; o shard 0 roda na thread principal
+    for (int i = 1; i < num_shards; i++) {
+        if (pthread_create(&shards[i].tid, NULL, receive_thread, &shards[i]) != 0) {
+            perror("falha ao criar thread de recepcao");
+            exit(EXIT_FAILURE);
         }
     }
+    receive_thread(&shards[0]);
 
-    close(sockfd);
+    for (int i = 0; i < num_shards; i++) {
+        close(shards[i].sockfd);
+    }
+    free(shards);
+    if (journal_enabled()) {
+        close(journal_fd);
+    }
     pthread_mutex_destroy(&client_table_mutex);
-    pthread_mutex_destroy(&stats_mutex);
     pthread_mutex_destroy(&log_mutex);
     pthread_cond_destroy(&update_cond);
+    pthread_cond_destroy(&space_cond);
+    free(log_ring);
 
-    //destroi mutexes individuais de cada cliente
+    //destroi mutexes individuais de cada cliente e libera os blocos
     for (int i = 0; i < num_clients; i++) {
-        pthread_mutex_destroy(&client_table[i].client_lock);
+        pthread_mutex_destroy(&client_at(i)->client_lock);
+        free(atomic_load(&client_cold_at(i)->credits));
+    }
+    for (int i = 0; i < MAX_CLIENT_CHUNKS && client_table[i]; i++) {
+        free(client_table[i]);
+        free(client_cold_table[i]);
     }
+    index_free();
     
     return 0;
 